@@ -1,3 +1,9 @@
 #define MAX_TAGS 256			// Max number of tag services
 #define MAX_LV 32   			// Max number of levels
-#define MAX_SIZE 4096		    // Max buffer size
\ No newline at end of file
+#define MAX_SIZE 4096		    // Max buffer size
+#define INLINE_SIZE 64			// Messages up to this size are carried inline without heap allocation
+#define MSG_RESERVE 16			// Messages of each size class kept in reserve
+#define WS_ENTRIES 64			// Max number of pairs of tag and level in a wait set
+#define MAX_HISTORY 1024		// Max number of messages kept in the history of a level
+#define MAX_MAILBOX 1024		// Max number of messages kept in the mailbox of a subscription
+#define MAX_RING 256			// Max number of messages kept in a ring shared with user space, each slot fits MAX_SIZE
\ No newline at end of file
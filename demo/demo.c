@@ -9,24 +9,65 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ipc.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include "../include/tag_dev.h"
 
 // System calls numbers
 #define TAG_GET 134
 #define TAG_SEND 174
 #define TAG_RECEIVE 182
 #define TAG_CTL 183
+#define TAG_SEND_MULTI 214
+#define TAG_SEND_MASK 215
+#define TAG_RECEIVE_MASK 236
+#define TAG_WAITSET 177
+#define TAG_WAITSET_WAIT 178
+#define TAG_FD 180
+#define TAG_LEVEL_CTL 181
+#define TAG_RECEIVE_SEQ 184
+#define TAG_SUBSCRIBE 185
+
+// Level command numbers
+#define LV_HISTORY 1
+#define LV_RETAIN 2
+
+#define MAX_DESTS 16    // Max number of destinations of msend
+#define DEVICE "/dev/tag_dev"
+
+
+struct tag_event_t {
+
+    int tag;        // tag service descriptor
+    int level;      // level number
+
+};
+
+
+struct tag_dest_t {
+
+    int tag;        // tag service descriptor
+    int level;      // level number
+    int ret;        // result of the send
+
+};
 
 
 void show_help();
 void print_error(char *string);
+void print_hist(char *name, unsigned long long *hist);
 
 
 int main(void){
 
     char *command, *choice1, *choice2, *choice3, *buffer;
-    char *s1, *s2, *s3;
-    int p1, p2, p3, ret;
+    char *s1, *s2, *s3, *s4;
+    int p1, p2, p3, ret, i;
+    unsigned long mask, seq;
     int uid;
+    struct tag_dest_t dests[MAX_DESTS];
+    struct tag_event_t event;
+    struct tag_hist_req hist;
 
     uid = (int)getuid();
 
@@ -123,6 +164,62 @@ int main(void){
                 print_error("Error");
             }
 
+        }
+        else if(strcmp(choice3, "msend") == 0){
+
+            p1 = 0;
+
+            // Read pairs of tag and level
+            while(p1 < MAX_DESTS && (s1 = strtok(NULL, " ")) != NULL && (s2 = strtok(NULL, " ")) != NULL){
+                dests[p1].tag = atoi(s1);
+                dests[p1].level = atoi(s2);
+                p1++;
+            }
+
+            if(p1 == 0 || choice2 == NULL) {
+                print_error("Wrong number of parameters");
+                continue;
+            }
+
+            ret = syscall(TAG_SEND_MULTI, dests, p1, choice2, strlen(choice2));
+
+            if(ret < 0){
+                print_error("Error");
+                continue;
+            }
+
+            for(i=0; i<p1; i++){
+                printf("tag %d level %d : %s\n", dests[i].tag, dests[i].level, dests[i].ret == 0 ? "sent" : "failed");
+            }
+
+        }
+        else if(strcmp(choice3, "bsend") == 0){
+
+            s1 = strtok(NULL, " ");
+
+            mask = 0;
+
+            // Read levels
+            while((s2 = strtok(NULL, " ")) != NULL){
+                mask |= 1UL << atoi(s2);
+            }
+
+            if(s1 == NULL || mask == 0 || choice2 == NULL) {
+                print_error("Wrong number of parameters");
+                continue;
+            }
+
+            p1 = atoi(s1);
+
+            ret = syscall(TAG_SEND_MASK, p1, mask, choice2, strlen(choice2));
+
+            if(ret < 0){
+                print_error("Error");
+            }
+            else{
+                printf("levels reached : %d\n", ret);
+            }
+
         }
         else if(strcmp(choice3, "recv") == 0){
 
@@ -150,15 +247,355 @@ int main(void){
 
             ret = syscall(TAG_RECEIVE, p1, p2, buffer, p3);
 
+            if(ret < 0){
+                print_error("Error");
+            }
+            else{
+                printf("Buffer received (%d bytes) : %.*s\n", ret, ret, buffer);
+            }
+
+            free(buffer);
+
+        }
+        else if(strcmp(choice3, "mrecv") == 0){
+
+            s1 = strtok(NULL, " ");
+            s3 = strtok(NULL, " ");
+
+            mask = 0;
+
+            // Read levels
+            while((s2 = strtok(NULL, " ")) != NULL){
+                mask |= 1UL << atoi(s2);
+            }
+
+            if(s1 == NULL || s3 == NULL || mask == 0) {
+                print_error("Wrong number of parameters");
+                continue;
+            }
+
+            p1 = atoi(s1);
+            p3 = atoi(s3);
+
+            buffer = (char *)malloc(p3*sizeof(char));
+
+            // Checking if buffer was correctly allocated
+            if (buffer == NULL){
+                print_error("Buffer allocation error");
+                continue;
+            }
+
+            memset(buffer, 0 , p3*sizeof(char)); // Empty buffer
+
+            ret = syscall(TAG_RECEIVE_MASK, p1, mask, buffer, p3, &p2);
+
+            if(ret < 0){
+                print_error("Error");
+            }
+            else{
+                printf("Buffer received from level %d (%d bytes) : %.*s\n", p2, ret, ret, buffer);
+            }
+
+            free(buffer);
+
+        }
+        else if(strcmp(choice3, "wsnew") == 0){
+
+            ret = syscall(TAG_WAITSET, 0, 1, 0, 0);
+
+            if(ret < 0){
+                print_error("Error");
+            }
+            else{
+                printf("wait set descriptor : %d\n",ret);
+            }
+
+        }
+        else if(strcmp(choice3, "wsadd") == 0 || strcmp(choice3, "wsrm") == 0){
+
+            s1 = strtok(NULL, " ");
+            s2 = strtok(NULL, " ");
+            s3 = strtok(NULL, " ");
+
+            if(s1 == NULL || s2 == NULL || s3 == NULL) {
+                print_error("Wrong number of parameters");
+                continue;
+            }
+
+            p1 = atoi(s1);
+            p2 = atoi(s2);
+            p3 = atoi(s3);
+
+            ret = syscall(TAG_WAITSET, p1, strcmp(choice3, "wsadd") == 0 ? 2 : 3, p2, p3);
+
             if(ret != 0){
                 print_error("Error");
             }
+
+        }
+        else if(strcmp(choice3, "wsdel") == 0){
+
+            s1 = strtok(NULL, " ");
+
+            if(s1 == NULL) {
+                print_error("Wrong number of parameters");
+                continue;
+            }
+
+            p1 = atoi(s1);
+
+            ret = close(p1);
+
+            if(ret != 0){
+                print_error("Error");
+            }
+
+        }
+        else if(strcmp(choice3, "wswait") == 0){
+
+            s1 = strtok(NULL, " ");
+            s2 = strtok(NULL, " ");
+
+            if(s1 == NULL || s2 == NULL) {
+                print_error("Wrong number of parameters");
+                continue;
+            }
+
+            p1 = atoi(s1);
+            p2 = atoi(s2);
+
+            buffer = (char *)malloc(p2*sizeof(char));
+
+            // Checking if buffer was correctly allocated
+            if (buffer == NULL){
+                print_error("Buffer allocation error");
+                continue;
+            }
+
+            memset(buffer, 0 , p2*sizeof(char)); // Empty buffer
+
+            ret = syscall(TAG_WAITSET_WAIT, p1, &event, buffer, p2);
+
+            if(ret < 0){
+                print_error("Error");
+            }
             else{
-                printf("Buffer received : %s\n", buffer);
+                printf("Buffer received from tag %d level %d (%d bytes) : %.*s\n", event.tag, event.level, ret, ret, buffer);
             }
 
             free(buffer);
 
+        }
+        else if(strcmp(choice3, "fd") == 0){
+
+            s1 = strtok(NULL, " ");
+            s2 = strtok(NULL, " ");
+
+            if(s1 == NULL || s2 == NULL) {
+                print_error("Wrong number of parameters");
+                continue;
+            }
+
+            p1 = atoi(s1);
+            p2 = atoi(s2);
+
+            ret = syscall(TAG_FD, p1, p2, O_NONBLOCK);
+
+            if(ret < 0){
+                print_error("Error");
+            }
+            else{
+                printf("file descriptor : %d\n",ret);
+            }
+
+        }
+        else if(strcmp(choice3, "sub") == 0){
+
+            s1 = strtok(NULL, " ");
+            s2 = strtok(NULL, " ");
+            s3 = strtok(NULL, " ");
+            s4 = strtok(NULL, " ");
+
+            if(s1 == NULL || s2 == NULL || s3 == NULL || s4 == NULL) {
+                print_error("Wrong number of parameters");
+                continue;
+            }
+
+            p1 = atoi(s1);
+            p2 = atoi(s2);
+            p3 = atoi(s3);
+
+            ret = syscall(TAG_SUBSCRIBE, p1, p2, p3, atoi(s4), O_NONBLOCK);
+
+            if(ret < 0){
+                print_error("Error");
+            }
+            else{
+                printf("file descriptor : %d\n",ret);
+            }
+
+        }
+        else if(strcmp(choice3, "fdread") == 0){
+
+            s1 = strtok(NULL, " ");
+            s2 = strtok(NULL, " ");
+
+            if(s1 == NULL || s2 == NULL) {
+                print_error("Wrong number of parameters");
+                continue;
+            }
+
+            p1 = atoi(s1);
+            p2 = atoi(s2);
+
+            buffer = (char *)malloc(p2*sizeof(char));
+
+            // Checking if buffer was correctly allocated
+            if (buffer == NULL){
+                print_error("Buffer allocation error");
+                continue;
+            }
+
+            memset(buffer, 0 , p2*sizeof(char)); // Empty buffer
+
+            ret = read(p1, buffer, p2);
+
+            if(ret < 0){
+                print_error("Error");
+            }
+            else{
+                printf("Buffer received (%d bytes) : %.*s\n", ret, ret, buffer);
+            }
+
+            free(buffer);
+
+        }
+        else if(strcmp(choice3, "fdclose") == 0){
+
+            s1 = strtok(NULL, " ");
+
+            if(s1 == NULL) {
+                print_error("Wrong number of parameters");
+                continue;
+            }
+
+            p1 = atoi(s1);
+
+            if(close(p1) != 0){
+                print_error("Error");
+            }
+
+        }
+        else if(strcmp(choice3, "keep") == 0){
+
+            s1 = strtok(NULL, " ");
+            s2 = strtok(NULL, " ");
+            s3 = strtok(NULL, " ");
+
+            if(s1 == NULL || s2 == NULL || s3 == NULL) {
+                print_error("Wrong number of parameters");
+                continue;
+            }
+
+            p1 = atoi(s1);
+            p2 = atoi(s2);
+            p3 = atoi(s3);
+
+            if(syscall(TAG_LEVEL_CTL, p1, p2, LV_HISTORY, p3) < 0){
+                print_error("Error");
+            }
+
+        }
+        else if(strcmp(choice3, "retain") == 0){
+
+            s1 = strtok(NULL, " ");
+            s2 = strtok(NULL, " ");
+            s3 = strtok(NULL, " ");
+
+            if(s1 == NULL || s2 == NULL || s3 == NULL) {
+                print_error("Wrong number of parameters");
+                continue;
+            }
+
+            p1 = atoi(s1);
+            p2 = atoi(s2);
+            p3 = atoi(s3);
+
+            if(syscall(TAG_LEVEL_CTL, p1, p2, LV_RETAIN, p3) < 0){
+                print_error("Error");
+            }
+
+        }
+        else if(strcmp(choice3, "srecv") == 0){
+
+            s1 = strtok(NULL, " ");
+            s2 = strtok(NULL, " ");
+            s3 = strtok(NULL, " ");
+            s4 = strtok(NULL, " ");
+
+            if(s1 == NULL || s2 == NULL || s3 == NULL || s4 == NULL) {
+                print_error("Wrong number of parameters");
+                continue;
+            }
+
+            p1 = atoi(s1);
+            p2 = atoi(s2);
+            seq = strtoul(s3, NULL, 10);
+            p3 = atoi(s4);
+
+            buffer = (char *)malloc(p3*sizeof(char));
+
+            // Checking if buffer was correctly allocated
+            if (buffer == NULL){
+                print_error("Buffer allocation error");
+                continue;
+            }
+
+            memset(buffer, 0 , p3*sizeof(char)); // Empty buffer
+
+            ret = syscall(TAG_RECEIVE_SEQ, p1, p2, buffer, p3, &seq, O_NONBLOCK);
+
+            if(ret < 0){
+                print_error("Error");
+            }
+            else{
+                printf("Buffer received with sequence number %lu (%d bytes) : %.*s\n", seq, ret, ret, buffer);
+            }
+
+            free(buffer);
+
+        }
+        else if(strcmp(choice3, "hist") == 0 || strcmp(choice3, "hreset") == 0){
+
+            s1 = strtok(NULL, " ");
+
+            if(s1 == NULL) {
+                print_error("Wrong number of parameters");
+                continue;
+            }
+
+            hist.tag = atoi(s1);
+
+            p1 = open(DEVICE, O_RDONLY);
+
+            if(p1 < 0){
+                print_error("Unable to open device");
+                continue;
+            }
+
+            if(strcmp(choice3, "hist") == 0) ret = ioctl(p1, TAG_IOC_HIST, &hist);
+            else ret = ioctl(p1, TAG_IOC_HIST_RESET, &hist.tag);
+
+            close(p1);
+
+            if(ret != 0){
+                print_error("Error");
+            }
+            else if(strcmp(choice3, "hist") == 0){
+                print_hist("delivery", hist.delivery);
+                print_hist("blocked", hist.blocked);
+            }
+
         }
         else if(strcmp(choice3, "awake") == 0){
 
@@ -222,7 +659,24 @@ void show_help(){
     printf("| get key                          - create new tag (key = 0 private)  |\n");
     printf("| open key                         - open tag                          |\n");
     printf("| send tag level 'message'         - send message to tag               |\n");
+    printf("| msend tag level [...] 'message'  - send message to many tags         |\n");
+    printf("| bsend tag level [...] 'message'  - send message to many levels       |\n");
     printf("| recv tag level size              - receive message from tag          |\n");
+    printf("| mrecv tag size level [...]       - receive message from many levels  |\n");
+    printf("| wsnew                            - create new wait set               |\n");
+    printf("| wsadd ws tag level               - add tag and level to set          |\n");
+    printf("| wsrm ws tag level                - remove tag and level from set     |\n");
+    printf("| wsdel ws                         - remove wait set                   |\n");
+    printf("| wswait ws size                   - receive message from wait set     |\n");
+    printf("| fd tag level                     - create file descriptor for tag    |\n");
+    printf("| sub tag level depth policy       - subscribe to level with mailbox   |\n");
+    printf("| fdread fd size                   - read message from file descriptor |\n");
+    printf("| fdclose fd                       - close file descriptor             |\n");
+    printf("| keep tag level depth             - keep history of level messages    |\n");
+    printf("| retain tag level flag            - retain last message of level      |\n");
+    printf("| srecv tag level seq size         - receive message newer than seq    |\n");
+    printf("| hist tag                         - show latency percentiles of tag   |\n");
+    printf("| hreset tag                       - reset latency histograms of tag   |\n");
     printf("| awake tag                        - awake all threads from tag        |\n");
     printf("| del tag                          - remove tag                        |\n");
     printf("| help                             - show this manual                  |\n");
@@ -244,4 +698,29 @@ void print_error(char *string){
     perror(string);
 
     printf("\033[0m\n"); // remove red
-}
\ No newline at end of file
+}
+
+/* Prints percentiles of a latency histogram, as the upper bound of the bucket they fall in
+ *
+ * name = name of the histogram
+ * hist = log2 buckets of nanoseconds
+ *
+*/
+void print_hist(char *name, unsigned long long *hist){
+    unsigned long long total, seen;
+    double perc[] = {0.5, 0.99, 0.999};
+    int i, j;
+
+    total = 0;
+    for(i=0; i<HIST_BUCKETS; i++) total += hist[i];
+
+    printf("%s : %llu samples", name, total);
+
+    for(j=0, i=0, seen=0; j<3 && total > 0; j++){
+        // First bucket reaching the percentile
+        while(i < HIST_BUCKETS - 1 && seen + hist[i] < perc[j]*total) seen += hist[i++];
+        printf("   p%g < %llu ns", perc[j]*100, 1ULL << i);
+    }
+
+    printf("\n");
+}
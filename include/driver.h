@@ -1,2 +1,3 @@
 int init_device(void);
 void cleanup_device(void);
+void notify_change(void);
@@ -1,7 +1,31 @@
-int insert_level(struct list_head *lv_head, spinlock_t lock, int num);
-int search_level(struct list_head *lv_head, int num);
-int wait_for_message(struct list_head *lv_head, int num, char *buffer, size_t size);
-int wakeup_all(struct list_head *lv_head, spinlock_t lock);
-int wakeup_level(struct list_head *lv_head, spinlock_t lock, int num, char * message);
-int cleanup_levels(struct list_head *lv_head, spinlock_t lock);
-int force_cleanup(struct list_head *lv_head, spinlock_t lock);
+struct message_t;
+struct small_message_t;
+struct tag_t;
+struct level_t;
+struct level_wait_t;
+struct sub_t;
+
+int init_level_cache(void);
+void destroy_level_cache(void);
+int insert_level(struct tag_t *tag, int num);
+int search_level(struct tag_t *tag, int num);
+int wait_for_message(struct tag_t *tag, int num, struct message_t **message, struct small_message_t *small);
+int enter_wait(struct level_wait_t *w, struct tag_t *tag, int num);
+int wait_any(struct level_wait_t *w, int count);
+void leave_wait(struct level_wait_t *w, struct message_t **message, struct small_message_t *small);
+int wait_for_mask(struct tag_t *tag, unsigned long mask, int *num, struct message_t **message, struct small_message_t *small);
+struct level_t *listen_level(struct tag_t *tag, int num, unsigned long *seq);
+void unlisten_level(struct tag_t *tag, struct level_t *p);
+int take_message(struct tag_t *tag, struct level_t *p, unsigned long *seq, struct message_t **message, struct small_message_t *small);
+struct level_t *subscribe_level(struct tag_t *tag, int num, struct sub_t *sub);
+void unsubscribe_level(struct tag_t *tag, struct sub_t *sub);
+int take_mailbox(struct sub_t *sub, struct message_t **message, struct small_message_t *small);
+int set_history(struct tag_t *tag, int num, unsigned int depth);
+int set_retain(struct tag_t *tag, int num, int retain);
+int read_history(struct tag_t *tag, int num, unsigned long *seq, int nonblock, struct message_t **message, struct small_message_t *small);
+int wakeup_all(struct tag_t *tag);
+int wakeup_level(struct tag_t *tag, int num, struct message_t *message);
+void discard_message(struct tag_t *tag, int num);
+int wakeup_mask(struct tag_t *tag, unsigned long mask, struct message_t *message);
+int cleanup_levels(struct tag_t *tag);
+int force_cleanup(struct tag_t *tag);
\ No newline at end of file
@@ -0,0 +1,10 @@
+struct message_t;
+struct small_message_t;
+
+int init_message_caches(void);
+void destroy_message_caches(void);
+struct message_t *alloc_message(size_t size);
+struct message_t *init_small_message(struct small_message_t *small, size_t size);
+struct message_t *copy_small_message(struct small_message_t *small, struct message_t *message);
+struct message_t *get_message(struct message_t *message);
+void put_message(struct message_t *message);
@@ -1,6 +1,19 @@
+struct tag_dest_t;
+struct tag_event_t;
+
 int tag_get(int key, int command, int permission);
 int tag_send(int tag, int level, char *buffer, size_t size);
+int tag_send_multi(struct tag_dest_t *dests, int count, char *buffer, size_t size);
+int tag_send_mask(int tag, unsigned long mask, char *buffer, size_t size);
 int tag_receive(int tag, int level, char *buffer, size_t size);
+int tag_receive_mask(int tag, unsigned long mask, char *buffer, size_t size, int *level);
+int tag_receive_seq(int tag, int level, char *buffer, size_t size, unsigned long *seq, int flags);
+int tag_waitset(int ws, int command, int tag, int level);
+int tag_waitset_wait(int ws, struct tag_event_t *event, char *buffer, size_t size);
+int tag_fd(int tag, int level, int flags);
+int tag_subscribe(int tag, int level, int depth, int policy, int flags);
+int tag_level_ctl(int tag, int level, int command, int arg);
 int tag_ctl(int tag, int command);
 
+int init_service(void);
 void cleanup_service(void);
\ No newline at end of file
@@ -0,0 +1,14 @@
+struct tag_t;
+struct level_t;
+struct tag_stats_t;
+struct tag_hist_t;
+
+struct tag_stats_t __percpu *alloc_stats(void);
+void free_stats(struct tag_stats_t __percpu *stats);
+void add_stat(struct tag_t *tag, struct level_t *level, int stat, u64 n);
+void read_stats(struct tag_stats_t __percpu *stats, struct tag_stats_t *sum);
+struct tag_hist_t __percpu *alloc_hist(void);
+void free_hist(struct tag_hist_t __percpu *hist);
+void add_latency(struct tag_t *tag, int hist, u64 ns);
+void read_hist(struct tag_hist_t __percpu *hist, struct tag_hist_t *sum);
+void reset_hist(struct tag_hist_t __percpu *hist);
\ No newline at end of file
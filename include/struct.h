@@ -1,25 +1,189 @@
+#include "../config.h"
+#include "tag_dev.h"
+#include "tag_ring.h"
+
+#define MSG_INLINE (-1)          // Class of messages carried inline, they're copied instead of being shared
+
+// Overflow policies of subscription mailboxes
+#define SUB_DROP_OLDEST 0       // The oldest message is dropped to make room for the new one
+#define SUB_DROP_NEWEST 1       // The new message is dropped
+#define SUB_SHARED 2            // Mailbox in a ring shared with user space, the new message is dropped
+
+// Layout of shared rings, the copy in the ring header is only for user space
+#define RING_SLOT_SIZE ALIGN(sizeof(struct tag_ring_slot) + MAX_SIZE, SMP_CACHE_BYTES)    // Fits the largest message
+#define RING_OFFSET ALIGN(sizeof(struct tag_ring), SMP_CACHE_BYTES)                        // Header before the slots
+
+// Traffic counters
+enum {
+    STAT_SENT,                  // Messages sent
+    STAT_DELIVERED,             // Messages delivered, one for each receiver
+    STAT_DISCARDED,             // Messages discarded because no thread was waiting
+    STAT_BYTES,                 // Bytes delivered to receivers
+    STAT_SIGNALS,               // Waits interrupted by a signal
+    STAT_ALLOC_FAIL,            // Allocation failures
+    STATS
+};
+
+struct tag_stats_t {
+
+    u64 count[STATS];           // Counters indexed by STAT_*
+
+};
+
+// Latency histograms
+enum {
+    HIST_DELIVERY,              // Time from send to the return of each receiver
+    HIST_BLOCKED,               // Time receivers spent blocked
+    HISTS
+};
+
+struct tag_hist_t {
+
+    u64 count[HISTS][HIST_BUCKETS];     // Log2 buckets of nanoseconds, see /include/tag_dev.h
+
+};
+
+struct message_t {
+
+    atomic_t refs;              // Number of threads currently holding the message
+    int class;                  // Size class the message was allocated from
+    size_t size;                // Message size
+    char buffer[];              // Message content
+
+};
+
+struct small_message_t {
+
+    struct message_t head;
+    char buffer[INLINE_SIZE];   // Inline storage for the content of head
+
+};
+
 struct tag_t{
 
     int key;                    // Key
+    int desc;                   // Descriptor, index in the list of tags and generation of the slot
+    struct hlist_node node;     // Key index entry
     int private;                // If service it's private this value is set to 1
     uid_t perm;                 // User id for permission check
 
-    int used;                   // If service it's being used this value is > 0
+    struct percpu_ref ref;      // Threads currently using the service
     int removing;               // If service it's being removed this value is set to 1
+    struct completion released; // Completed when the last user of a service being removed is gone
 
-    struct list_head *lv_head;  // List of levels
-    spinlock_t lv_lock;         // Level list write lock
+    struct level_t __rcu *levels[MAX_LV];       // Levels indexed by number, created on first use
+    DECLARE_BITMAP(active, MAX_LV);             // Levels with threads currently waiting
+    DECLARE_BITMAP(kept, MAX_LV);               // Levels keeping messages even if no thread is waiting
+    spinlock_t lv_lock;                         // Level table write lock
+
+    struct tag_stats_t __percpu *stats;         // Traffic counters of all levels
+    struct tag_hist_t __percpu *hist;           // Latency histograms of all levels
+
+    struct rcu_head rcu;        // Deferred reclamation
 
 };
 
-struct level_t {
+struct history_t {
+
+    struct message_t *message;  // Message kept, NULL if the slot is empty
+    unsigned long seq;          // Generation the message was published as
+    struct small_message_t small; // Storage for the message if it's carried inline
 
-    struct list_head list;
+};
+
+struct level_t {
 
     int num;                    // Level number
-    char *message;              // Message to send
+    struct message_t *message;  // Last message delivered, kept while threads are waiting
+    struct small_message_t small; // Storage for the last message delivered if it's carried inline
+    unsigned long seq;          // Generation, bumped every time a message is delivered
+    u64 stamp;                  // Time the current generation was published
+    unsigned long awake;        // Last generation published by AWAKE_ALL, so that waiters not getting a message notice it
     int threads;                // Number of processes currently waiting for the message
-    wait_queue_head_t *wq;      // Head of wait queue
+    struct history_t *history;  // Ring of the last messages published, NULL unless enabled
+    unsigned int depth;         // Number of slots of the history ring
+    int retain;                 // If the last message published should be retained this value is set to 1
+    struct history_t last;      // Last message published, kept if retain is set
+    struct list_head subs;      // Subscriptions whose mailbox is filled by every message published
+    struct list_head rings;     // Subscriptions whose shared ring is filled by every message published, rcu protected
+    struct list_head waiters;   // Wait entries of the threads waiting, each one gets the next message published
+    spinlock_t lock;            // Message, generation, threads and history lock
+    wait_queue_head_t wq;       // Head of wait queue
+
+    struct tag_stats_t __percpu *stats; // Traffic counters
+
+    struct rcu_head rcu;        // Deferred reclamation
+
+};
+
+struct level_wait_t {
+
+    struct tag_t *tag;          // Tag service owning the level
+    struct level_t *level;      // Level the thread is waiting on
+    int num;                    // Level number
+    wait_queue_entry_t entry;   // Entry in the level's wait queue
+    struct list_head node;      // Entry in the level's list of waiters
+    struct message_t *message;  // Message delivered at publish time, NULL until one is sent
+    u64 stamp;                  // Publish time of the delivered message
+    struct small_message_t small; // Storage for the delivered message if it's carried inline
+
+};
+
+struct ws_entry_t {
+
+    int tag;                    // Tag service descriptor
+    int level;                  // Level number
+
+};
+
+struct waitset_t {
+
+    struct mutex lock;          // Wait set lock
+    int count;                  // Number of entries
+    struct ws_entry_t entries[WS_ENTRIES];  // Pairs of tag and level to wait on
+    int waiting;                // Whether a thread is using the wait entries below
+    struct level_wait_t wait[WS_ENTRIES];   // Wait entries kept for a thread waiting, so that waits don't allocate
 
 };
 
+struct tag_event_t {
+
+    int tag;                    // Tag service descriptor the message was delivered on
+    int level;                  // Level number the message was delivered on
+
+};
+
+struct tag_file_t {
+
+    struct tag_t *tag;          // Tag service, checked for the whole life of the file
+    struct level_t *level;      // Level the file is listening on
+    int desc;                   // Tag service descriptor
+    unsigned long seq;          // Generation of the last message read
+
+};
+
+struct sub_t {
+
+    struct tag_t *tag;          // Tag service, checked for the whole life of the subscription
+    struct level_t *level;      // Level subscribed to
+    int desc;                   // Tag service descriptor
+    struct list_head node;      // Entry in the level's list of subscriptions or of rings, written under the level lock
+    int policy;                 // Overflow policy, SUB_DROP_*
+    unsigned int depth;         // Number of slots of the mailbox
+    unsigned int head;          // Slot of the oldest message in the mailbox
+    unsigned int count;         // Number of messages in the mailbox
+    struct history_t *box;      // Mailbox, protected by the level lock, NULL if the ring is used instead
+    struct tag_ring *ring;      // Ring shared with user space, NULL unless the policy is SUB_SHARED
+    size_t ring_size;           // Size of the ring including its header
+    unsigned int tail;          // Next slot of the ring to be written, user space can't tamper with it
+    spinlock_t lock;            // Ring lock, held by senders while writing in the ring
+
+};
+
+struct tag_dest_t {
+
+    int tag;                    // Tag service descriptor
+    int level;                  // Level number
+    int ret;                    // Result of the send to this destination
+
+};
@@ -0,0 +1 @@
+int create_subscription(int desc, int level, uid_t uid, unsigned int depth, int policy, int flags);
\ No newline at end of file
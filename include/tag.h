@@ -1,8 +1,27 @@
+struct message_t;
+struct small_message_t;
+struct tag_t;
+struct tag_hist_t;
+struct tag_record;
+
+int init_tag_cache(void);
+void destroy_tag_cache(void);
 int search_tag(int key);
 int open_tag(int key, uid_t perm);
 int insert_tag(int key, int private, uid_t uid);
+struct tag_t *check_tag(int desc, uid_t uid);
+void uncheck_tag(struct tag_t *tag);
 int delete_tag(int desc, uid_t uid);
-int wait_tag_message(int desc, int level, uid_t uid, char *message, size_t size);
-int wakeup_tag_level(int desc, int level, uid_t uid, char *message);
+int wait_tag_message(int desc, int level, uid_t uid, struct message_t **message, struct small_message_t *small);
+int wait_tag_mask(int desc, unsigned long mask, uid_t uid, int *level, struct message_t **message, struct small_message_t *small);
+int wakeup_tag_level(int desc, int level, uid_t uid, struct message_t *message);
+int wakeup_tag_mask(int desc, unsigned long mask, uid_t uid, struct message_t *message);
+int tag_level_waiting(int desc, int level, uid_t uid);
+int read_tag_history(int desc, int level, uid_t uid, unsigned long *seq, int nonblock, struct message_t **message, struct small_message_t *small);
+int tag_level_history(int desc, int level, uid_t uid, unsigned int depth);
+int tag_level_retain(int desc, int level, uid_t uid, int retain);
 void cleanup_tags(void);
-int tag_info(char *buffer);
\ No newline at end of file
+int tag_hist(int desc, uid_t uid, struct tag_hist_t *sum);
+int tag_hist_reset(int desc, uid_t uid);
+int tag_info(struct tag_record *info, int max);
+int tag_query(int desc, int key, struct tag_record *info);
\ No newline at end of file
@@ -0,0 +1,63 @@
+/* ---------------------------------------------------------------------------------------------------------------------
+ TAG DEVICE INTERFACE
+
+ Requests accepted by the ioctl of the tag device driver ( see /lib/driver.c), shared by the module and user space.
+ The layout of the snapshot records is versioned, TAG_SNAPSHOT_VERSION changes whenever it does.
+--------------------------------------------------------------------------------------------------------------------- */
+
+#ifndef TAG_DEV_H
+#define TAG_DEV_H
+
+#include <linux/ioctl.h>
+
+#define HIST_BUCKETS 32         // Bucket i counts latencies in [2^(i-1), 2^i) ns, the last one everything above
+
+struct tag_hist_req {
+
+    int tag;                                    // Tag service descriptor
+    unsigned long long delivery[HIST_BUCKETS];  // Time from send to the return of each receiver
+    unsigned long long blocked[HIST_BUCKETS];   // Time receivers spent blocked
+
+};
+
+#define TAG_SNAPSHOT_VERSION 1
+#define TAG_COUNTERS 6          // Sent, delivered, discarded, bytes, signals and allocation failures, in this order
+#define TAG_QUERY_RECORDS 33    // Totals of a tag service and one record for each of its levels, MAX_LV + 1
+
+struct tag_record {
+
+    int key;                                    // Tag service key
+    int creator;                                // User id of the creator, -1 if any user is allowed
+    int level;                                  // Level number, -1 for the totals of the tag service
+    int waiters;                                // Number of threads waiting
+    unsigned long long count[TAG_COUNTERS];     // Traffic counters
+
+};
+
+struct tag_snapshot_req {
+
+    unsigned int version;                       // Set to TAG_SNAPSHOT_VERSION by the driver
+    unsigned int size;                          // Set to the size of a record by the driver
+    unsigned int max;                           // Number of records that fit in records
+    unsigned int count;                         // Number of records of the snapshot, may be more than max
+    struct tag_record *records;                 // Where to store the records
+
+};
+
+struct tag_query_req {
+
+    int tag;                                    // Tag service descriptor, -1 to select the service by key
+    int key;                                    // Tag service key, only used if tag is -1
+    unsigned int version;                       // Set to TAG_SNAPSHOT_VERSION by the driver
+    unsigned int count;                         // Set to the number of records of the service by the driver
+    struct tag_record records[TAG_QUERY_RECORDS]; // Totals of the service followed by a record for each level in use
+
+};
+
+#define TAG_IOC_MAGIC 'T'
+#define TAG_IOC_HIST _IOWR(TAG_IOC_MAGIC, 1, struct tag_hist_req)     // Read latency histograms of a tag service
+#define TAG_IOC_HIST_RESET _IOW(TAG_IOC_MAGIC, 2, int)                // Reset latency histograms of a tag service
+#define TAG_IOC_SNAPSHOT _IOWR(TAG_IOC_MAGIC, 3, struct tag_snapshot_req) // Read the records of all tag services
+#define TAG_IOC_QUERY _IOWR(TAG_IOC_MAGIC, 4, struct tag_query_req)   // Read the records of a single tag service
+
+#endif
@@ -0,0 +1,39 @@
+/* ---------------------------------------------------------------------------------------------------------------------
+ TAG RING INTERFACE
+
+ Layout of the ring shared with user space by subscriptions created with the SUB_SHARED policy ( see
+ /lib/subscription.c), mapped with mmap on the file descriptor of the subscription. The module writes each message in
+ the slot at tail and then publishes it with a release store of tail, the receiver reads the slots from head to tail
+ after an acquire load of tail and then releases them with a release store of head. A single receiver per ring is
+ supported, when the ring is empty it sleeps with poll on the file descriptor.
+--------------------------------------------------------------------------------------------------------------------- */
+
+#ifndef TAG_RING_H
+#define TAG_RING_H
+
+struct tag_ring {
+
+    unsigned int head;          // Next slot to be read, written by the receiver
+    unsigned int pad[15];       // Keeps head and tail on different cache lines
+    unsigned int tail;          // Next slot to be written, written by the module
+    unsigned int dropped;       // Messages dropped because the ring was full
+    unsigned int slots;         // Number of slots
+    unsigned int slot_size;     // Size of each slot
+    unsigned int offset;        // Offset of the first slot from the start of the ring
+
+};
+
+struct tag_ring_slot {
+
+    unsigned long long seq;     // Sequence number of the message on its level
+    unsigned int size;          // Message size
+    unsigned int pad;
+    char data[];                // Message content
+
+};
+
+// Slot holding the message with index i, head and tail run freely and wrap around the slots
+#define TAG_RING_SLOT(ring, i) ((struct tag_ring_slot *)((char *)(ring) + (ring)->offset + \
+                                ((i) % (ring)->slots) * (ring)->slot_size))
+
+#endif
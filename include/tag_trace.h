@@ -0,0 +1,156 @@
+/* ---------------------------------------------------------------------------------------------------------------------
+ TAG TRACEPOINTS
+
+ Tracepoints of the tag service, they can be enabled at run time through ftrace or perf (events/tag/) and cost
+ nothing otherwise. They replace the logging of successful operations on the fast path.
+--------------------------------------------------------------------------------------------------------------------- */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM tag
+
+#if !defined(_TAG_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TAG_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(tag_get,
+
+    TP_PROTO(int key, int command, int desc),
+
+    TP_ARGS(key, command, desc),
+
+    TP_STRUCT__entry(
+        __field(int, key)
+        __field(int, command)
+        __field(int, desc)
+    ),
+
+    TP_fast_assign(
+        __entry->key = key;
+        __entry->command = command;
+        __entry->desc = desc;
+    ),
+
+    TP_printk("key=%d command=%d desc=%d", __entry->key, __entry->command, __entry->desc)
+);
+
+TRACE_EVENT(tag_send,
+
+    TP_PROTO(int desc, int level, size_t size, int ret),
+
+    TP_ARGS(desc, level, size, ret),
+
+    TP_STRUCT__entry(
+        __field(int, desc)
+        __field(int, level)
+        __field(size_t, size)
+        __field(int, ret)
+    ),
+
+    TP_fast_assign(
+        __entry->desc = desc;
+        __entry->level = level;
+        __entry->size = size;
+        __entry->ret = ret;
+    ),
+
+    TP_printk("desc=%d level=%d size=%zu ret=%d", __entry->desc, __entry->level, __entry->size, __entry->ret)
+);
+
+TRACE_EVENT(tag_send_mask,
+
+    TP_PROTO(int desc, unsigned long mask, size_t size, int ret),
+
+    TP_ARGS(desc, mask, size, ret),
+
+    TP_STRUCT__entry(
+        __field(int, desc)
+        __field(unsigned long, mask)
+        __field(size_t, size)
+        __field(int, ret)
+    ),
+
+    TP_fast_assign(
+        __entry->desc = desc;
+        __entry->mask = mask;
+        __entry->size = size;
+        __entry->ret = ret;
+    ),
+
+    TP_printk("desc=%d mask=%#lx size=%zu levels=%d", __entry->desc, __entry->mask, __entry->size, __entry->ret)
+);
+
+TRACE_EVENT(tag_wait_start,
+
+    TP_PROTO(int desc, unsigned long mask),
+
+    TP_ARGS(desc, mask),
+
+    TP_STRUCT__entry(
+        __field(int, desc)
+        __field(unsigned long, mask)
+        __field(pid_t, pid)
+    ),
+
+    TP_fast_assign(
+        __entry->desc = desc;
+        __entry->mask = mask;
+        __entry->pid = current->pid;
+    ),
+
+    TP_printk("desc=%d mask=%#lx pid=%d", __entry->desc, __entry->mask, __entry->pid)
+);
+
+TRACE_EVENT(tag_receive_wake,
+
+    TP_PROTO(int desc, int level, int ret),
+
+    TP_ARGS(desc, level, ret),
+
+    TP_STRUCT__entry(
+        __field(int, desc)
+        __field(int, level)
+        __field(int, ret)
+        __field(pid_t, pid)
+    ),
+
+    TP_fast_assign(
+        __entry->desc = desc;
+        __entry->level = level;
+        __entry->ret = ret;
+        __entry->pid = current->pid;
+    ),
+
+    TP_printk("desc=%d level=%d ret=%d pid=%d", __entry->desc, __entry->level, __entry->ret, __entry->pid)
+);
+
+TRACE_EVENT(tag_ctl,
+
+    TP_PROTO(int desc, int command, int ret),
+
+    TP_ARGS(desc, command, ret),
+
+    TP_STRUCT__entry(
+        __field(int, desc)
+        __field(int, command)
+        __field(int, ret)
+    ),
+
+    TP_fast_assign(
+        __entry->desc = desc;
+        __entry->command = command;
+        __entry->ret = ret;
+    ),
+
+    TP_printk("desc=%d command=%d ret=%d", __entry->desc, __entry->command, __entry->ret)
+);
+
+#endif
+
+// Out of tree module, the header is searched in the include directory added by the Makefile
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE tag_trace
+
+#include <trace/define_trace.h>
@@ -0,0 +1 @@
+int create_tag_fd(int desc, int level, uid_t uid, int flags);
\ No newline at end of file
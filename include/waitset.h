@@ -0,0 +1,8 @@
+struct message_t;
+struct small_message_t;
+struct tag_event_t;
+
+int create_waitset(void);
+int add_waitset(int ws, uid_t uid, int tag, int level);
+int remove_waitset(int ws, int tag, int level);
+int waitset_wait(int ws, uid_t uid, struct tag_event_t *event, struct message_t **message, struct small_message_t *small);
\ No newline at end of file
@@ -1,7 +1,12 @@
 /* ---------------------------------------------------------------------------------------------------------------------
  TAG DRIVER
 
- This module implements a simple device driver which keeps information about the tag services currently active
+ This module implements a simple device driver which keeps information about the tag services currently active.
+ Each open takes a snapshot of the live tag services and their levels, which is then streamed through a seq_file so
+ that every reader gets a consistent view and only the rows actually in use are formatted. A change counter, bumped
+ whenever tag services or levels are created or removed or a level gains its first waiter or loses its last one, lets
+ readers poll the device and take a new snapshot by reading again from the beginning once something changed. The
+ counter is only bumped while the device file is open, so that receivers don't share its cache line otherwise.
 --------------------------------------------------------------------------------------------------------------------- */
 
 #include <linux/kernel.h>
@@ -11,9 +16,18 @@
 #include <linux/cdev.h>
 #include <linux/fs.h>
 #include <linux/slab.h>
-#include <linux/spinlock.h>
+#include <linux/seq_file.h>
+#include <linux/mm.h>
+#include <linux/uaccess.h>
+#include <linux/cred.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/atomic.h>
+#include <linux/jump_label.h>
 #include "../include/tag.h"
 #include "../include/driver.h"
+#include "../include/struct.h"
+#include "../include/tag_dev.h"
 #include "../config.h"
 
 MODULE_LICENSE("GPL");
@@ -22,27 +36,43 @@ MODULE_DESCRIPTION("TAG DRIVER");
 
 #define MODNAME "TAG DRIVER"
 #define DEVICE_NAME "tag_dev"
-#define BUFF_LEN (MAX_TAGS*MAX_LV + 1)*100 // Buffer size
 
-static char *buff; // Buffer used to keep tag services info
+// Snapshot of the tag services taken when the device file is opened
+struct snapshot_t {
+    int count;                  // Number of records
+    struct tag_record info[];   // Records, see tag_info
+};
+
+// State of an open device file
+struct view_t {
+    unsigned int seen;          // Value of the change counter when the snapshot was taken
+    struct snapshot_t *snap;    // Rows being read, replaced when reading from the beginning after a change
+};
+
+static atomic_t changes = ATOMIC_INIT(0);           // Change counter
+static DECLARE_WAIT_QUEUE_HEAD(change_wq);          // Readers polling for changes
+static DEFINE_STATIC_KEY_FALSE(observed);           // Enabled while the device file is open
 
 // Device
 static dev_t dev = 0;
 static struct class *dev_class;
 static struct cdev c_dev;
-static spinlock_t dev_lock;
 
 
 // Device file operations
 static int device_open(struct inode *, struct file *);
 static int device_release(struct inode *, struct file *);
-static ssize_t device_read(struct file *, char __user *, size_t, loff_t *);
 static ssize_t device_write(struct file *, const char *, size_t, loff_t *);
+static long device_ioctl(struct file *, unsigned int, unsigned long);
+static __poll_t device_poll(struct file *, poll_table *);
 
 static struct file_operations fops = {
         .owner = THIS_MODULE,
-        .read = device_read,
+        .read = seq_read,
+        .llseek = seq_lseek,
         .write = device_write,
+        .unlocked_ioctl = device_ioctl,
+        .poll = device_poll,
         .open = device_open,
         .release = device_release
 };
@@ -85,17 +115,6 @@ int init_device(void) {
         return -1;
     }
 
-    // Allocate new buffer
-    buff = (char *)kmalloc(sizeof(char)*BUFF_LEN, GFP_ATOMIC);
-    if(buff == NULL){
-        printk(KERN_ERR "%s: Unable to allocate new buffer\n", MODNAME);
-        cdev_del(&c_dev);
-        device_destroy(dev_class,dev);
-        class_destroy(dev_class);
-        unregister_chrdev_region(dev, 1);
-        return -1;
-    }
-
     printk("%s: %s successfully registered\n", MODNAME, DEVICE_NAME);
     return 0;
 }
@@ -109,53 +128,296 @@ void cleanup_device(void) {
     class_destroy(dev_class);
     unregister_chrdev_region(dev, 1);
 
-    kfree(buff);
-
     printk("%s: %s unregistered successfully\n", MODNAME, DEVICE_NAME);
 }
 
 
-/* Open device file */
-static int device_open(struct inode *inode, struct file *file) {
-    // Do nothing
-    return 0;
+/* Signals readers polling the device that tag services or their levels changed */
+void notify_change(void){
+
+    // Nobody can be polling, files opened later start from a new snapshot anyway
+    if(!static_branch_unlikely(&observed)) return;
+
+    smp_mb__before_atomic(); // The change is visible to whoever sees the new counter
+    atomic_inc(&changes);
+
+    if(wq_has_sleeper(&change_wq)) wake_up_interruptible(&change_wq);
 }
 
 
-/* Close device file */
-static int device_release(struct inode *inode, struct file *file) {
-    // Do nothing
-    return 0;
+/* Takes a snapshot of the tag services currently active, retrying if new levels appear while it's being taken
+ *
+ * seen = where to store the value of the change counter the snapshot is up to date with
+ *
+ */
+static struct snapshot_t *take_snapshot(unsigned int *seen){
+    struct snapshot_t *snap;
+    int max, count;
+
+    // Changes made while the snapshot is taken are reported again
+    *seen = atomic_read(&changes);
+    smp_rmb();
+
+    count = tag_info(NULL, 0);
+
+    do{
+        // Leave room for some levels created in the meantime
+        max = count + MAX_LV;
+
+        snap = (struct snapshot_t *)kvmalloc(struct_size(snap, info, max), GFP_KERNEL);
+        if(snap == NULL){
+            printk(KERN_ERR "%s: Unable to allocate new snapshot\n", MODNAME);
+            return NULL;
+        }
+
+        count = tag_info(snap->info, max);
+        if(count <= max) break;
+
+        kvfree(snap);
+    }while(1);
+
+    snap->count = count;
+    return snap;
 }
 
+/* Returns the record at the given position, the header comes first */
+static void *info_record(struct view_t *view, loff_t pos) {
 
-/* Read device file */
-static ssize_t device_read(struct file *filp, char __user *user_buff, size_t size, loff_t *off) {
-    ssize_t len;
+    if(pos == 0) return SEQ_START_TOKEN;
+    if(pos > view->snap->count) return NULL;
 
-    // Update buffer with new tag info
-    spin_lock(&dev_lock);
-    if(tag_info(buff) < 0) printk("%s: Unable to update buffer with new info\n", MODNAME);
-    spin_unlock(&dev_lock);
+    return &view->snap->info[pos - 1];
+}
 
-    len = min((size_t)BUFF_LEN - (size_t)*off, size);
+/* Starts reading at the given position, reading from the beginning after a change takes a new snapshot */
+static void *info_start(struct seq_file *m, loff_t *pos) {
+    struct view_t *view = (struct view_t *)m->private;
+    struct snapshot_t *snap;
+    unsigned int seen;
 
-    if (len <= 0) {
+    if(*pos == 0 && atomic_read(&changes) != view->seen){
+        snap = take_snapshot(&seen);
+        if(snap == NULL) return ERR_PTR(-ENOMEM);
+
+        kvfree(view->snap);
+        view->snap = snap;
+        WRITE_ONCE(view->seen, seen);
+    }
+
+    return info_record(view, *pos);
+}
+
+/* Moves to the next record */
+static void *info_next(struct seq_file *m, void *v, loff_t *pos) {
+    ++*pos;
+    return info_record((struct view_t *)m->private, *pos);
+}
+
+/* Nothing to release, the snapshot lasts until the file is closed or read again after a change */
+static void info_stop(struct seq_file *m, void *v) {
+}
+
+/* Writes a row of info about a tag service or one of its levels */
+static int info_show(struct seq_file *m, void *v) {
+    struct tag_record *info = (struct tag_record *)v;
+
+    if(v == SEQ_START_TOKEN){
+        seq_puts(m, " TAG-key   TAG-creator   TAG-level   Waiting-threads         Sent    Delivered    Discarded          Bytes    Signals   Alloc-fail \n");
         return 0;
     }
 
-    // Copy data to user
-    if (copy_to_user(user_buff, buff + *off, len)) {
-        return -EFAULT;
+    seq_printf(m, " %7d   %11d   ", info->key, info->creator);
+
+    if(info->level < 0) seq_printf(m, "%9s", "all");
+    else seq_printf(m, "%9d", info->level);
+
+    seq_printf(m, "   %15d   %10llu   %10llu   %10llu   %12llu   %8llu   %10llu \n", info->waiters,
+               info->count[STAT_SENT], info->count[STAT_DELIVERED], info->count[STAT_DISCARDED],
+               info->count[STAT_BYTES], info->count[STAT_SIGNALS], info->count[STAT_ALLOC_FAIL]);
+
+    return 0;
+}
+
+static const struct seq_operations info_ops = {
+        .start = info_start,
+        .next = info_next,
+        .stop = info_stop,
+        .show = info_show
+};
+
+
+/* Open device file, taking a snapshot of the tag services */
+static int device_open(struct inode *inode, struct file *file) {
+    struct view_t *view;
+
+    view = (struct view_t *)__seq_open_private(file, &info_ops, sizeof(struct view_t));
+    if(view == NULL) return -ENOMEM;
+
+    // Changes are counted from now on, patching the branch syncs every cpu before the snapshot is taken
+    static_branch_inc(&observed);
+
+    view->snap = take_snapshot(&view->seen);
+    if(view->snap == NULL){
+        static_branch_dec(&observed);
+        seq_release_private(inode, file);
+        return -ENOMEM;
     }
 
-    *off += len;
+    return 0;
+}
+
+
+/* Close device file, releasing its snapshot */
+static int device_release(struct inode *inode, struct file *file) {
+    struct view_t *view = (struct view_t *)((struct seq_file *)file->private_data)->private;
 
-    return len;
+    kvfree(view->snap);
+    static_branch_dec(&observed);
+
+    return seq_release_private(inode, file);
 }
 
+
+/* Poll device file, it's readable once something changed since its snapshot was taken */
+static __poll_t device_poll(struct file *file, poll_table *wait) {
+    struct view_t *view = (struct view_t *)((struct seq_file *)file->private_data)->private;
+
+    poll_wait(file, &change_wq, wait);
+
+    if(atomic_read(&changes) != READ_ONCE(view->seen)) return EPOLLIN | EPOLLRDNORM | EPOLLPRI;
+
+    return 0;
+}
+
+
 /* Write device file */
 static ssize_t device_write(struct file *filp, const char *user_buff, size_t size, loff_t *off) {
     printk("%s: Write not implemented\n", MODNAME);
     return -1;
-}
\ No newline at end of file
+}
+
+/* Reads the latency histograms of a tag service
+ *
+ * arg = user space struct tag_hist_req, its tag field selects the tag service
+ *
+ */
+static long hist_ioctl(unsigned long arg){
+    struct tag_hist_req *req;
+    struct tag_hist_t *sum;
+    long ret;
+
+    req = (struct tag_hist_req *)kmalloc(sizeof(struct tag_hist_req), GFP_KERNEL);
+    sum = (struct tag_hist_t *)kmalloc(sizeof(struct tag_hist_t), GFP_KERNEL);
+    if(req == NULL || sum == NULL){
+        kfree(req);
+        kfree(sum);
+        return -ENOMEM;
+    }
+
+    BUILD_BUG_ON(sizeof(req->delivery) != sizeof(sum->count[HIST_DELIVERY]));
+
+    ret = 0;
+
+    if(copy_from_user(&req->tag, (void __user *)arg, sizeof(int))) ret = -EFAULT;
+    else if(tag_hist(req->tag, current_uid().val, sum) < 0) ret = -EINVAL;
+    else{
+        memcpy(req->delivery, sum->count[HIST_DELIVERY], sizeof(req->delivery));
+        memcpy(req->blocked, sum->count[HIST_BLOCKED], sizeof(req->blocked));
+
+        if(copy_to_user((void __user *)arg, req, sizeof(struct tag_hist_req))) ret = -EFAULT;
+    }
+
+    kfree(req);
+    kfree(sum);
+    return ret;
+}
+
+/* Reads the records of all tag services at once, without any text formatting
+ *
+ * arg = user space struct tag_snapshot_req, its max and records fields select where the records are stored
+ *
+ */
+static long snapshot_ioctl(unsigned long arg){
+    struct tag_snapshot_req req;
+    struct tag_record *records;
+    int count;
+
+    if(copy_from_user(&req, (void __user *)arg, sizeof(struct tag_snapshot_req))) return -EFAULT;
+
+    // No more records than a snapshot can hold
+    req.max = min_t(unsigned int, req.max, MAX_TAGS*(MAX_LV + 1));
+
+    records = NULL;
+    if(req.max > 0){
+        records = (struct tag_record *)kvmalloc_array(req.max, sizeof(struct tag_record), GFP_KERNEL);
+        if(records == NULL) return -ENOMEM;
+    }
+
+    count = tag_info(records, req.max);
+
+    req.version = TAG_SNAPSHOT_VERSION;
+    req.size = sizeof(struct tag_record);
+    req.count = count;
+
+    if(copy_to_user(req.records, records, min_t(unsigned int, count, req.max)*sizeof(struct tag_record)) ||
+       copy_to_user((void __user *)arg, &req, sizeof(struct tag_snapshot_req))){
+        kvfree(records);
+        return -EFAULT;
+    }
+
+    kvfree(records);
+    return 0;
+}
+
+/* Reads the records of a single tag service, selected by descriptor or by key
+ *
+ * arg = user space struct tag_query_req, its tag and key fields select the tag service
+ *
+ */
+static long query_ioctl(unsigned long arg){
+    struct tag_query_req *req;
+    long ret;
+    int count;
+
+    BUILD_BUG_ON(TAG_QUERY_RECORDS != MAX_LV + 1);
+
+    req = (struct tag_query_req *)kmalloc(sizeof(struct tag_query_req), GFP_KERNEL);
+    if(req == NULL) return -ENOMEM;
+
+    ret = 0;
+
+    if(copy_from_user(req, (void __user *)arg, 2*sizeof(int))) ret = -EFAULT;
+    else if((count = tag_query(req->tag, req->key, req->records)) < 0) ret = -EINVAL;
+    else{
+        req->version = TAG_SNAPSHOT_VERSION;
+        req->count = count;
+
+        // Records past count are left untouched
+        if(copy_to_user((void __user *)arg, req, offsetof(struct tag_query_req, records) + count*sizeof(struct tag_record))) ret = -EFAULT;
+    }
+
+    kfree(req);
+    return ret;
+}
+
+/* Device file requests, see /include/tag_dev.h */
+static long device_ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
+    int tag;
+
+    switch(cmd){
+        case TAG_IOC_HIST:
+            return hist_ioctl(arg);
+
+        case TAG_IOC_HIST_RESET:
+            if(copy_from_user(&tag, (void __user *)arg, sizeof(int))) return -EFAULT;
+            return tag_hist_reset(tag, current_uid().val) < 0 ? -EINVAL : 0;
+
+        case TAG_IOC_SNAPSHOT:
+            return snapshot_ioctl(arg);
+
+        case TAG_IOC_QUERY:
+            return query_ioctl(arg);
+    }
+
+    return -ENOTTY;
+}
@@ -1,7 +1,11 @@
 /* ---------------------------------------------------------------------------------------------------------------------
-RCU LEVEL LIST
+RCU LEVEL TABLE
 
- This module implements an rcu list in which the elements are levels ( see /include/types.h for struct level_t).
+ This module implements a table of levels directly indexed by level number ( see /include/struct.h for struct level_t).
+ Each tag service keeps an rcu protected slot for every level, created on first use, plus a bitmap of the levels on
+ which threads are currently waiting. Levels can also keep a ring with the history of the last messages published,
+ tagged with their generation, so that receivers can ask for everything published after a given generation, or just
+ retain the last message published so that late receivers get it without waiting for the next one.
 --------------------------------------------------------------------------------------------------------------------- */
 
 #include <linux/module.h>
@@ -14,308 +18,1084 @@ RCU LEVEL LIST
 #include <linux/wait.h>
 #include <linux/types.h>
 #include <linux/sched.h>
+#include <linux/rcupdate.h>
+#include <linux/bitops.h>
+#include <linux/timekeeping.h>
+#include <linux/mm.h>
+#include <linux/list.h>
+#include <linux/rculist.h>
 #include "../include/level.h"
+#include "../include/driver.h"
+#include "../include/message.h"
+#include "../include/stats.h"
 #include "../include/struct.h"
 #include "../config.h"
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Lisa Trombetti <lisa.trombetti96@gmail.com>");
-MODULE_DESCRIPTION("RCU LEVEL LIST");
+MODULE_DESCRIPTION("RCU LEVEL TABLE");
 
-#define MODNAME "RCU LV LIST"
+#define MODNAME "RCU LV TABLE"
 
 
-/* Insert a new level
+static struct kmem_cache *level_cache;  // Levels and their wait queues
+
+/* Creates level cache */
+int init_level_cache(void){
+
+    level_cache = kmem_cache_create("tag_level", sizeof(struct level_t), 0, SLAB_HWCACHE_ALIGN, NULL);
+    if(level_cache == NULL){
+        printk(KERN_ERR "%s: Unable to create level cache\n", MODNAME);
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+/* Destroys level cache, all levels must have been reclaimed */
+void destroy_level_cache(void){
+    kmem_cache_destroy(level_cache);
+}
+
+/* Insert a new level if it doesn't already exist
  *
- * lv_head = head of the list in which the new level will be added
- * lock = list write lock
+ * tag = tag service in which the new level will be added
  * num = level number
  *
  */
-int insert_level(struct list_head *lv_head, spinlock_t lock, int num){
+int insert_level(struct tag_t *tag, int num){
     struct level_t *new;
 
+    // Level already exists
+    if(rcu_access_pointer(tag->levels[num]) != NULL) return 0;
+
     // Allocate new level struct
-    new = (struct level_t *)kmalloc(sizeof(struct level_t), GFP_ATOMIC);
+    new = (struct level_t *)kmem_cache_alloc(level_cache, GFP_KERNEL);
     if(new == NULL) {
         printk(KERN_ERR "%s: Unable to allocate new level\n", MODNAME);
+        add_stat(tag, NULL, STAT_ALLOC_FAIL, 1);
+        return -ENOMEM;
+    }
+
+    new->stats = alloc_stats();
+    if(new->stats == NULL){
+        kmem_cache_free(level_cache, new);
+        add_stat(tag, NULL, STAT_ALLOC_FAIL, 1);
         return -ENOMEM;
     }
 
     new->num = num;
     new->message = NULL;
+    new->seq = 0;
+    new->awake = 0;
+    new->stamp = 0;
     new->threads = 0;
+    new->history = NULL;
+    new->depth = 0;
+    new->retain = 0;
+    new->last.message = NULL;
+    new->last.seq = 0;
+    INIT_LIST_HEAD(&new->subs);
+    INIT_LIST_HEAD(&new->rings);
+    INIT_LIST_HEAD(&new->waiters);
+    spin_lock_init(&new->lock);
+    init_waitqueue_head(&new->wq); // Initialize wait queue
 
-    // Initialize wait queue
-    new->wq = (wait_queue_head_t *) kmalloc(sizeof(wait_queue_head_t), GFP_ATOMIC);
-    if(new->wq == NULL) {
-        printk(KERN_ERR "%s: Unable to allocate new wait queue\n", MODNAME);
-        kfree(new);
-        return -ENOMEM;
+    spin_lock(&tag->lv_lock);
+
+    // Another thread may have created the level in the meantime
+    if(rcu_access_pointer(tag->levels[num]) != NULL){
+        spin_unlock(&tag->lv_lock);
+        free_stats(new->stats);
+        kmem_cache_free(level_cache, new);
+        return 0;
     }
-    init_waitqueue_head(new->wq);
 
-    spin_lock(&lock);
-    list_add_tail_rcu(&(new->list), lv_head); // Add at the tail of the list
-    spin_unlock(&lock);
+    rcu_assign_pointer(tag->levels[num], new); // Add to its slot
+    spin_unlock(&tag->lv_lock);
 
+    notify_change();
     return 0;
 }
 
-/* Searches a level by number
+/* Checks whether a message sent to a level would be published, either because threads are waiting on it or because
+ * it keeps messages
  *
- * lv_head = head of the list where the level should be searched
+ * tag = tag service owning the level
  * num = level number
  *
  */
-int search_level(struct list_head *lv_head, int num){
-    struct level_t *p;
+int search_level(struct tag_t *tag, int num){
+    return test_bit(num, tag->active) || test_bit(num, tag->kept) ? 0 : -1;
+}
 
-    rcu_read_lock();
+/* Takes a reference to a message, small messages are copied instead
+ *
+ * message = message to be shared
+ * small = where to copy the message if it's carried inline
+ *
+ */
+static struct message_t *share_message(struct message_t *message, struct small_message_t *small){
+
+    if(message->class == MSG_INLINE) return copy_small_message(small, message);
+
+    return get_message(message);
+}
+
+/* Hands over a reference kept in a slot, small messages are copied out of the slot's storage
+ *
+ * message = message kept in the slot
+ * small = where to copy the message if it's carried inline
+ *
+ */
+static struct message_t *hand_message(struct message_t *message, struct small_message_t *small){
+
+    if(message->class == MSG_INLINE) return copy_small_message(small, message);
+
+    return message;
+}
+
+/* Keeps a message in a slot, replacing the one it held
+ *
+ * slot = slot where the message should be kept
+ * message = message to be kept
+ * seq = generation the message was published as
+ *
+ * Returns the message replaced, to be released once the level lock is dropped.
+ *
+ */
+static struct message_t *keep_message(struct history_t *slot, struct message_t *message, unsigned long seq){
+    struct message_t *dropped;
+
+    dropped = slot->message;
+    slot->message = share_message(message, &slot->small); // Small messages overwrite the slot's storage in place
+    slot->seq = seq;
+
+    return dropped;
+}
+
+/* Writes a message straight in the ring a subscription shares with user space, holding the ring lock instead of the
+ * level lock so that copying the message doesn't delay the other senders and receivers of the level
+ *
+ * sub = subscription
+ * message = message to be written
+ * seq = generation the message was published as
+ *
+ */
+static void fill_ring(struct sub_t *sub, struct message_t *message, unsigned long seq){
+    struct tag_ring *ring = sub->ring;
+    struct tag_ring_slot *slot;
+
+    spin_lock(&sub->lock);
+
+    // Slots up to head were released by the receiver, the header is writable by user space so the index it wrote is
+    // only trusted to tell if the ring is full and the slot is located from the layout kept in the module
+    if(sub->tail - smp_load_acquire(&ring->head) >= sub->depth){
+        WRITE_ONCE(ring->dropped, READ_ONCE(ring->dropped) + 1);
+        spin_unlock(&sub->lock);
+        return;
+    }
 
-    list_for_each_entry(p, lv_head, list){
-        // Level found
-        if(p->num == num){
-            rcu_read_unlock();
-            return 0;
+    slot = (struct tag_ring_slot *)((char *)ring + RING_OFFSET + (sub->tail % sub->depth)*RING_SLOT_SIZE);
+    memcpy(slot->data, message->buffer, message->size);
+    slot->size = message->size;
+    slot->seq = seq;
+
+    smp_store_release(&ring->tail, ++sub->tail); // Slot visible to the receiver
+
+    spin_unlock(&sub->lock);
+
+    add_stat(sub->tag, sub->level, STAT_DELIVERED, 1);
+    add_stat(sub->tag, sub->level, STAT_BYTES, message->size);
+}
+
+/* Adds a message to the mailbox of a subscription, applying its overflow policy if full, must be called holding the
+ * level lock
+ *
+ * sub = subscription
+ * message = message to be added
+ * seq = generation the message was published as
+ *
+ */
+static void fill_mailbox(struct sub_t *sub, struct message_t *message, unsigned long seq){
+    struct history_t *slot;
+
+    if(sub->count == sub->depth){
+        if(sub->policy == SUB_DROP_NEWEST) return;
+
+        // Make room dropping the oldest message, releasing a message never sleeps
+        put_message(sub->box[sub->head].message);
+        sub->box[sub->head].message = NULL;
+        sub->head = (sub->head + 1) % sub->depth;
+        sub->count--;
+    }
+
+    slot = &sub->box[(sub->head + sub->count) % sub->depth];
+    slot->message = share_message(message, &slot->small);
+    slot->seq = seq;
+
+    sub->count++;
+}
+
+/* Publishes a message on the level as a new generation, the message is discarded if no thread is waiting and the
+ * level doesn't keep it
+ *
+ * level = level where the message should be published, must be called inside an rcu read side critical section
+ * message = message to be published
+ * record = whether the message should be kept in the history of the level, retained and added to the mailboxes of
+ *          subscriptions, wakeups aren't
+ *
+ */
+static int publish_message(struct level_t *level, struct message_t *message, int record){
+    struct message_t *old, *dropped, *replaced;
+    struct level_wait_t *w;
+    struct sub_t *sub;
+    unsigned long seq;
+    int waiting, history, retain;
+
+    old = NULL;
+    dropped = NULL;
+    replaced = NULL;
+
+    spin_lock(&level->lock);
+
+    waiting = level->threads > 0;
+    retain = record && level->retain;
+    history = record && level->history != NULL;
+
+    if(!waiting && !history && !retain){
+        spin_unlock(&level->lock);
+        return 0;
+    }
+
+    seq = ++level->seq; // New generation, waiters waiting on the previous one can proceed
+    level->stamp = ktime_get_ns();
+    if(!record) level->awake = seq;
+
+    if(waiting){
+        // Small messages are copied in the level's own storage, listeners take their own reference to the others
+        old = level->message;
+        level->message = share_message(message, &level->small);
+
+        // Every thread waiting gets the message now, so that a later one can't replace it before the thread runs
+        list_for_each_entry(w, &level->waiters, node){
+            if(w->message != NULL) continue; // Already delivered, only the first message is taken
+
+            w->message = share_message(message, &w->small);
+            w->stamp = level->stamp;
         }
+
+        // Subscriptions count as waiting, each one gets the message in its mailbox
+        if(record) list_for_each_entry(sub, &level->subs, node) fill_mailbox(sub, message, level->seq);
     }
 
-    rcu_read_unlock();
-    return -1;
+    // The oldest message in the ring is replaced
+    if(history) dropped = keep_message(&level->history[level->seq % level->depth], message, level->seq);
+
+    if(retain) replaced = keep_message(&level->last, message, level->seq);
+
+    spin_unlock(&level->lock);
+
+    // Rings are filled before waking up the threads polling them, without holding the level lock
+    if(waiting && record) list_for_each_entry_rcu(sub, &level->rings, node) fill_ring(sub, message, seq);
+
+    if(waiting) wake_up_interruptible(&level->wq); // Wake up waiting threads
+
+    put_message(old);
+    put_message(dropped);
+    put_message(replaced);
+    return 1;
 }
 
-/* Replaces level with an empty one
+/* Unregisters the calling thread from the level, once it's done no message is delivered to its wait entry anymore
  *
- * level = level to modify
- * lock = level list write lock
+ * tag = tag service owning the level
+ * p = level the thread was waiting on
+ * num = level number
+ * w = wait entry the messages were delivered to, NULL for listeners
  *
  */
-int replace_level(struct level_t *level, spinlock_t lock){
-    struct level_t *new;
+static void leave_level(struct tag_t *tag, struct level_t *p, int num, struct level_wait_t *w){
+    struct message_t *old;
+    int last;
 
-    // Allocate new level
-    new = (struct level_t *)kmalloc(sizeof(struct level_t), GFP_ATOMIC);
-    if(new == NULL){
-        printk(KERN_ERR "%s: Unable to allocate new level for replacement\n", MODNAME);
-        return -ENOMEM;
+    old = NULL;
+
+    spin_lock(&p->lock);
+
+    if(w != NULL) list_del(&w->node);
+
+    // Last thread leaving, the level doesn't need to keep the message anymore
+    last = --p->threads == 0;
+    if(last){
+        clear_bit(num, tag->active);
+        old = p->message;
+        p->message = NULL;
     }
 
-    new->num = level->num;
-    new->message = NULL;
-    new->threads = 0;
+    spin_unlock(&p->lock);
 
-    // Initialize wait queue
-    new->wq = (wait_queue_head_t *) kmalloc(sizeof(wait_queue_head_t), GFP_ATOMIC);
-    if(new->wq == NULL) {
-        printk(KERN_ERR "%s: Unable to allocate new wait queue for replacement\n", MODNAME);
-        kfree(new);
-        return -ENOMEM;
+    if(last) notify_change(); // Level lost its last waiter
+
+    put_message(old);
+}
+
+/* Registers the calling thread as waiting on the level, must be called inside an rcu read side critical section
+ *
+ * tag = tag service owning the level
+ * num = level number
+ * seq = where to store the current generation, NULL if not needed
+ * w = wait entry messages will be delivered to, NULL for listeners which take them from the level
+ *
+ */
+static struct level_t *enter_level(struct tag_t *tag, int num, unsigned long *seq, struct level_wait_t *w){
+    struct level_t *p;
+    int first;
+
+    p = rcu_dereference(tag->levels[num]);
+    if(p == NULL){
+        printk(KERN_ERR "%s: Unable to wait for message, level %d doesn't exist\n", MODNAME, num);
+        return NULL;
     }
-    init_waitqueue_head(new->wq);
 
-    spin_lock(&lock);
-    list_replace_rcu(&level->list, &new->list); // Replace with new level
-    spin_unlock(&lock);
+    // Signal that a new thread is waiting and take a snapshot of the current generation
+    spin_lock(&p->lock);
+    first = p->threads++ == 0;
+    if(first) set_bit(num, tag->active);
+    if(seq != NULL) *seq = p->seq;
+    if(w != NULL){
+        w->message = NULL;
+        list_add_tail(&w->node, &p->waiters);
+    }
+    spin_unlock(&p->lock);
 
-    return 0;
+    smp_mb(); // Pairs with delete_tag, either the removal sees this thread waiting or this thread sees the removal
+
+    // The removal may have unlinked the level before seeing this thread, it's only safe until the rcu section ends
+    if(READ_ONCE(tag->removing)){
+        printk(KERN_ERR "%s: Unable to wait for message, tag service is being removed\n", MODNAME);
+        leave_level(tag, p, num, w);
+        put_message(w != NULL ? w->message : NULL); // Messages published in the meantime
+        return NULL;
+    }
+
+    if(first) notify_change(); // Level gained its first waiter
+
+    return p; // Levels are never removed while threads are waiting on them
 }
 
 /* Wait for a message from the specified level to be delivered
  *
- * lv_head = head of the list where to search the level
+ * tag = tag service owning the level
  * num = level number
- * buffer = where to copy the message
- * size = buffer's size
+ * message = where to store the reference to the delivered message
+ * small = where to copy the delivered message if it's carried inline
  *
  */
-int wait_for_message(struct list_head *lv_head, int num, char *buffer, size_t size){
-    struct level_t *p;
+int wait_for_message(struct tag_t *tag, int num, struct message_t **message, struct small_message_t *small){
+    struct level_wait_t w;
     int ret;
 
+    if(enter_wait(&w, tag, num) < 0) return -1;
+
+    ret = wait_any(&w, 1);
+
+    leave_wait(&w, ret == 0 ? message : NULL, small);
+
+    return ret < 0 ? ret : 0;
+}
+
+/* Registers the calling thread as waiting on the level and adds it to the level's wait queue
+ *
+ * w = wait entry to be filled, see wait_any
+ * tag = tag service owning the level
+ * num = level number
+ *
+ */
+int enter_wait(struct level_wait_t *w, struct tag_t *tag, int num){
+
     rcu_read_lock();
-    list_for_each_entry_rcu(p, lv_head, list) {
+    w->level = enter_level(tag, num, NULL, w);
+    rcu_read_unlock();
 
-        // Level found
-        if(p->num == num){
-            __sync_fetch_and_add(&p->threads,1); // Signal that a new thread is waiting
+    if(w->level == NULL) return -1;
 
-            ret = wait_event_interruptible(*p->wq, p->message != NULL); // Wait for message
+    w->tag = tag;
+    w->num = num;
 
-            if(ret == 0){
-                // Copy message
-                strncpy((char*)buffer, (char*)p->message, min(size, strlen(p->message)));
+    init_waitqueue_entry(&w->entry, current);
+    add_wait_queue(&w->level->wq, &w->entry);
 
-                __sync_fetch_and_add(&p->threads,-1); // Signal that the message was read
+    return 0;
+}
 
-                rcu_read_unlock();
-                return 0;
-            }
+/* Sleeps until a message is delivered on any of the levels the calling thread entered
+ *
+ * w = wait entries filled by enter_wait
+ * count = number of wait entries
+ *
+ * Returns the index of the first entry a message was delivered to.
+ *
+ */
+int wait_any(struct level_wait_t *w, int count){
+    u64 start;
+    int i;
+
+    start = ktime_get_ns();
+
+    while(1){
+        set_current_state(TASK_INTERRUPTIBLE); // Senders publishing after the check below will wake this thread up
 
-            __sync_fetch_and_add(&p->threads,-1); // Signal that the thread is waiting no more
+        for(i=0; i<count; i++){
+            if(READ_ONCE(w[i].message) != NULL){
+                __set_current_state(TASK_RUNNING);
+                add_latency(w[i].tag, HIST_BLOCKED, ktime_get_ns() - start); // Accounted to the tag that delivered
+                return i;
+            }
+        }
 
-            rcu_read_unlock();
+        if(signal_pending(current)){
+            __set_current_state(TASK_RUNNING);
             printk(KERN_ERR "%s: Process %d woken up by signal\n", MODNAME, current->pid);
-            return ret;
+
+            // Every level the thread was waiting on sees the interrupted wait
+            for(i=0; i<count; i++){
+                add_stat(w[i].tag, w[i].level, STAT_SIGNALS, 1);
+            }
+
+            add_latency(w[0].tag, HIST_BLOCKED, ktime_get_ns() - start);
+
+            return -ERESTARTSYS;
         }
-    }
 
-    rcu_read_unlock();
-    printk(KERN_ERR "%s: Unable to wait for message, level %d doesn't exist\n", MODNAME, num);
-    return -1;
+        schedule();
+    }
 }
 
-/* Wakes up all threads waiting in the list
+/* Removes the calling thread from the level's wait queue and unregisters it, taking the delivered message if requested
  *
- * lv_head = head of the list where to search the level
- * lock = list write lock
+ * w = wait entry filled by enter_wait
+ * message = where to store the reference to the delivered message, NULL if not needed
+ * small = where to copy the delivered message if it's carried inline
  *
  */
-int wakeup_all(struct list_head *lv_head, spinlock_t lock){
-    struct level_t *p;
-    char *message;
+void leave_wait(struct level_wait_t *w, struct message_t **message, struct small_message_t *small){
+    remove_wait_queue(&w->level->wq, &w->entry);
+    leave_level(w->tag, w->level, w->num, w);
+
+    // Nothing is delivered to the entry anymore, messages not taken are released
+    if(w->message == NULL) return;
 
-    // Allocate new empty message
-    message = (char *)kmalloc(sizeof(char), GFP_ATOMIC);
     if(message == NULL){
-        printk(KERN_ERR "%s: Unable to allocate new message to wake up waiting threads\n", MODNAME);
+        put_message(w->message);
+        return;
+    }
+
+    *message = hand_message(w->message, small);
+
+    add_stat(w->tag, w->level, STAT_DELIVERED, 1);
+    add_stat(w->tag, w->level, STAT_BYTES, (*message)->size);
+    add_latency(w->tag, HIST_DELIVERY, ktime_get_ns() - w->stamp); // Send to receiver's return
+}
+
+/* Wait for a message from any of the specified levels to be delivered, sleeping on all their wait queues at once
+ *
+ * tag = tag service owning the levels
+ * mask = bitmask of level numbers
+ * num = where to store the number of the level the message was delivered on
+ * message = where to store the reference to the delivered message
+ * small = where to copy the delivered message if it's carried inline
+ *
+ */
+int wait_for_mask(struct tag_t *tag, unsigned long mask, int *num, struct message_t **message, struct small_message_t *small){
+    struct level_wait_t *w;
+    unsigned long i;
+    int n, j, ret;
+
+    // One entry for each level requested, too large to be kept on the stack
+    w = (struct level_wait_t *)kmalloc_array(hweight_long(mask), sizeof(struct level_wait_t), GFP_KERNEL);
+    if(w == NULL){
+        printk(KERN_ERR "%s: Unable to allocate wait entries\n", MODNAME);
         return -ENOMEM;
     }
-    snprintf(message, sizeof(char), "%s", "\n");
+
+    n = 0;
+    ret = 0;
+
+    for_each_set_bit(i, &mask, MAX_LV){
+        if(enter_wait(&w[n], tag, i) < 0){
+            ret = -1;
+            break;
+        }
+        n++;
+    }
+
+    if(ret == 0) ret = wait_any(w, n); // Index of the level the message was delivered on
+
+    for(j=0; j<n; j++){
+        leave_wait(&w[j], j == ret ? message : NULL, small);
+    }
+
+    if(ret >= 0){
+        *num = w[ret].num;
+        ret = 0;
+    }
+
+    kfree(w);
+    return ret;
+}
+
+/* Registers a listener on the level, the level keeps the last message delivered until the listener leaves
+ *
+ * tag = tag service owning the level
+ * num = level number
+ * seq = where to store the current generation of the level
+ *
+ */
+struct level_t *listen_level(struct tag_t *tag, int num, unsigned long *seq){
+    struct level_t *p;
 
     rcu_read_lock();
+    p = enter_level(tag, num, seq, NULL);
+    rcu_read_unlock();
 
-    list_for_each_entry(p, lv_head, list){
+    return p;
+}
 
-        if(!__sync_bool_compare_and_swap(&p->message, NULL, message)){
-            printk(KERN_ERR "%s: Unable to send message to wake up level %d\n", MODNAME, p->num);
-            rcu_read_unlock();
-            kfree(message);
-            return -1;
-        }
+/* Unregisters a listener from the level
+ *
+ * tag = tag service owning the level
+ * p = level returned by listen_level
+ *
+ */
+void unlisten_level(struct tag_t *tag, struct level_t *p){
+    leave_level(tag, p, p->num, NULL);
+}
+
+/* Takes the last message delivered on the level if it's newer than the generation already seen by a listener
+ *
+ * tag = tag service owning the level
+ * p = level returned by listen_level
+ * seq = generation already seen, updated if a message is taken
+ * message = where to store the reference to the delivered message
+ * small = where to copy the delivered message if it's carried inline
+ *
+ * Returns 1 if a message was taken, 0 otherwise, and -ECANCELED if the newer generation was published by AWAKE_ALL,
+ * which is then seen as well.
+ *
+ */
+int take_message(struct tag_t *tag, struct level_t *p, unsigned long *seq, struct message_t **message, struct small_message_t *small){
+
+    spin_lock(&p->lock);
+
+    if(p->seq == *seq){
+        spin_unlock(&p->lock);
+        return 0;
+    }
+
+    *seq = p->seq;
+
+    // No message was sent, reading it would look like the end of file
+    if(p->awake == p->seq){
+        spin_unlock(&p->lock);
+        return -ECANCELED;
+    }
+
+    // Copy small messages, share sender's message otherwise
+    *message = share_message(p->message, small);
+
+    spin_unlock(&p->lock);
+
+    add_stat(tag, p, STAT_DELIVERED, 1);
+    add_stat(tag, p, STAT_BYTES, (*message)->size);
+    return 1;
+}
+
+/* Subscribes to the level, every message published is then added to the mailbox of the subscription until it leaves
+ *
+ * tag = tag service owning the level
+ * num = level number
+ * sub = subscription, its mailbox must be empty
+ *
+ */
+struct level_t *subscribe_level(struct tag_t *tag, int num, struct sub_t *sub){
+    struct level_t *p;
+    unsigned long seq;
+
+    // Subscribing counts as waiting, so the tag service can't be removed
+    p = listen_level(tag, num, &seq);
+    if(p == NULL) return NULL;
+
+    spin_lock(&p->lock);
+    if(sub->ring != NULL) list_add_tail_rcu(&sub->node, &p->rings); // Rings are filled outside the level lock
+    else list_add_tail(&sub->node, &p->subs);
+    spin_unlock(&p->lock);
+
+    return p;
+}
+
+/* Removes a subscription from its level, dropping the messages left in its mailbox
+ *
+ * tag = tag service owning the level
+ * sub = subscription
+ *
+ */
+void unsubscribe_level(struct tag_t *tag, struct sub_t *sub){
+    struct level_t *p = sub->level;
+
+    spin_lock(&p->lock);
+    if(sub->ring != NULL) list_del_rcu(&sub->node);
+    else list_del(&sub->node);
+    spin_unlock(&p->lock);
+
+    // Senders may still be writing in the ring until a grace period has elapsed
+    if(sub->ring != NULL) synchronize_rcu();
+
+    // Nobody else can reach the mailbox anymore
+    for(; sub->count > 0; sub->count--){
+        put_message(sub->box[sub->head].message);
+        sub->box[sub->head].message = NULL;
+        sub->head = (sub->head + 1) % sub->depth;
+    }
+
+    unlisten_level(tag, p);
+}
+
+/* Takes the oldest message from the mailbox of a subscription
+ *
+ * sub = subscription
+ * message = where to store the reference to the message taken
+ * small = where to copy the message taken if it's carried inline
+ *
+ * Returns 1 if a message was taken, 0 if the mailbox is empty.
+ *
+ */
+int take_mailbox(struct sub_t *sub, struct message_t **message, struct small_message_t *small){
+    struct level_t *p = sub->level;
+    struct history_t *slot;
+
+    spin_lock(&p->lock);
+
+    if(sub->count == 0){
+        spin_unlock(&p->lock);
+        return 0;
+    }
+
+    slot = &sub->box[sub->head];
+
+    *message = hand_message(slot->message, small); // The mailbox's reference is handed over
+
+    slot->message = NULL;
+    sub->head = (sub->head + 1) % sub->depth;
+    sub->count--;
+
+    spin_unlock(&p->lock);
+
+    add_stat(sub->tag, p, STAT_DELIVERED, 1);
+    add_stat(sub->tag, p, STAT_BYTES, (*message)->size);
+    return 1;
+}
+
+/* Releases a history ring and the messages it keeps
+ *
+ * history = ring to be released, may be NULL
+ * depth = number of slots of the ring
+ *
+ */
+static void free_history(struct history_t *history, unsigned int depth){
+    unsigned int i;
+
+    if(history == NULL) return;
+
+    for(i=0; i<depth; i++) put_message(history[i].message);
+
+    kvfree(history);
+}
+
+/* Enables, resizes or disables the history of the last messages published on the level, the messages already kept
+ * are dropped
+ *
+ * tag = tag service owning the level
+ * num = level number
+ * depth = number of messages to be kept, at most MAX_HISTORY, 0 disables the history
+ *
+ */
+int set_history(struct tag_t *tag, int num, unsigned int depth){
+    struct level_t *p;
+    struct history_t *new, *old;
+    unsigned int old_depth;
 
-        wake_up_interruptible(p->wq); // Wake up waiting threads
+    new = NULL;
 
-        // Replace level with an empty one
-        if(replace_level(p, lock) < 0){
-            rcu_read_unlock();
-            kfree(message);
-            return -1;
+    if(depth > 0){
+        new = (struct history_t *)kvcalloc(depth, sizeof(struct history_t), GFP_KERNEL);
+        if(new == NULL){
+            printk(KERN_ERR "%s: Unable to allocate history of %u messages for level %d\n", MODNAME, depth, num);
+            add_stat(tag, NULL, STAT_ALLOC_FAIL, 1);
+            return -ENOMEM;
         }
+    }
+
+    rcu_read_lock();
 
+    p = rcu_dereference(tag->levels[num]);
+    if(p == NULL){
         rcu_read_unlock();
-        synchronize_rcu();
-        kfree(p->wq); // Reclaim space
-        kfree(p);
-        rcu_read_lock();
+        kvfree(new);
+        return -1;
     }
 
+    spin_lock(&p->lock);
+
+    old = p->history;
+    old_depth = p->depth;
+
+    p->history = new;
+    p->depth = depth;
+
+    // Senders publish on levels keeping messages even if nobody is waiting
+    if(p->history != NULL || p->retain) set_bit(num, tag->kept);
+    else clear_bit(num, tag->kept);
+
+    spin_unlock(&p->lock);
+
     rcu_read_unlock();
-    kfree(message);
+
+    free_history(old, old_depth);
     return 0;
 }
 
-/* Sends message to all waiting threads from level waking them up
+/* Starts or stops retaining the last message published on the level
  *
- * lv_head = head of the list where to search the level
- * lock = list write lock
+ * tag = tag service owning the level
  * num = level number
- * message = message to be sent
+ * retain = 1 to retain the last message, 0 to stop retaining it and drop the one retained
  *
  */
-int wakeup_level(struct list_head *lv_head, spinlock_t lock, int num, char * message){
+int set_retain(struct tag_t *tag, int num, int retain){
     struct level_t *p;
+    struct message_t *dropped;
 
-    rcu_read_lock();
+    dropped = NULL;
 
-    list_for_each_entry(p, lv_head, list){
+    rcu_read_lock();
 
-        // Level found
-        if(p->num == num){
+    p = rcu_dereference(tag->levels[num]);
+    if(p == NULL){
+        rcu_read_unlock();
+        return -1;
+    }
 
-            if(!__sync_bool_compare_and_swap(&p->message, NULL, message)){
-                printk(KERN_WARNING "%s: Unable to send message to level %d\n", MODNAME, p->num);
-                rcu_read_unlock();
-                return -1;
-            }
+    spin_lock(&p->lock);
 
-            wake_up_interruptible(p->wq); // Wake up waiting threads
+    p->retain = retain;
 
-            if(replace_level(p, lock) < 0){
-                rcu_read_unlock();
-                return -1;
-            }
+    if(!retain){
+        dropped = p->last.message;
+        p->last.message = NULL;
+    }
 
-            rcu_read_unlock();
-            synchronize_rcu();
-            kfree(p->wq); // Reclaim space
-            kfree(p);
+    // Senders publish on levels keeping messages even if nobody is waiting
+    if(p->history != NULL || p->retain) set_bit(num, tag->kept);
+    else clear_bit(num, tag->kept);
 
-            return 0;
-        }
-    }
+    spin_unlock(&p->lock);
 
     rcu_read_unlock();
-    printk("%s: Level %d doesn't exist, message will be discarded\n", MODNAME, num);
+
+    put_message(dropped);
     return 0;
 }
 
-/* Removes all levels in the list if no thread is currently waiting
+/* Looks for the oldest message kept in the history of the level that is newer than a generation, must be called
+ * holding the level lock
+ *
+ * p = level
+ * after = generation already seen
+ *
+ */
+static struct history_t *find_history(struct level_t *p, unsigned long after){
+    struct history_t *slot;
+    unsigned long s;
+
+    if(p->history == NULL || after >= p->seq) return NULL;
+
+    // Older generations were already replaced
+    s = after + 1;
+    if(p->seq - s >= p->depth) s = p->seq - p->depth + 1;
+
+    // Generations that weren't kept, like the ones of AWAKE_ALL, are skipped
+    for(; s <= p->seq; s++){
+        slot = &p->history[s % p->depth];
+        if(slot->message != NULL && slot->seq == s) return slot;
+    }
+
+    return NULL;
+}
+
+/* Reads the oldest message kept in the history of the level that is newer than a generation, or the message retained
+ * if it is newer and the history doesn't have any, waiting for a new one if none is and the caller is willing to block
+ *
+ * tag = tag service owning the level
+ * num = level number
+ * seq = generation already seen, updated with the generation of the message read
+ * nonblock = whether to fail with -EAGAIN instead of waiting
+ * message = where to store the reference to the message read
+ * small = where to copy the message read if it's carried inline
  *
- * lv_head = head of the list
- * lock = list write lock
+ * Fails with -ECANCELED if the thread waited and was woken up by AWAKE_ALL, which isn't kept in the history.
  *
  */
-int cleanup_levels(struct list_head *lv_head, spinlock_t lock){
+int read_history(struct tag_t *tag, int num, unsigned long *seq, int nonblock, struct message_t **message, struct small_message_t *small){
     struct level_t *p;
+    struct history_t *slot;
+    unsigned long gen, woken;
+    u64 start;
+    int ret;
 
+    // Registered as waiting, so that the level is kept while reading
     rcu_read_lock();
+    p = enter_level(tag, num, &gen, NULL);
+    rcu_read_unlock();
 
-    list_for_each_entry(p, lv_head, list){
+    if(p == NULL) return -1;
 
-        if(p->threads > 0){
-            rcu_read_unlock();
-            printk(KERN_ERR "%s: Unable to remove level %d, threads are still waiting for message\n", MODNAME, p->num);
-            return -1;
+    start = 0;
+    woken = 0;
+    ret = 0;
+
+    do{
+        spin_lock(&p->lock);
+
+        slot = find_history(p, *seq);
+
+        // Late receivers get the message retained without waiting for the next one
+        if(slot == NULL && p->retain && p->last.message != NULL && p->last.seq > *seq) slot = &p->last;
+
+        if(slot != NULL){
+            *message = share_message(slot->message, small);
+            *seq = slot->seq;
+        }
+        else if(p->history == NULL && !p->retain){
+            ret = -EINVAL;
+        }
+        else if(start != 0 && p->awake != woken){
+            ret = -ECANCELED; // Woken up while waiting
         }
 
-        spin_lock(&lock);
-        list_del_rcu(&p->list); // Remove element
-        spin_unlock(&lock);
+        gen = p->seq;
+        woken = p->awake;
 
-        rcu_read_unlock();
-        synchronize_rcu();
-        kfree(p); // Reclaim space
-        rcu_read_lock();
+        spin_unlock(&p->lock);
+
+        if(slot != NULL || ret < 0) break;
+
+        if(nonblock){
+            ret = -EAGAIN;
+            break;
+        }
+
+        if(start == 0) start = ktime_get_ns();
+
+        ret = wait_event_interruptible(p->wq, READ_ONCE(p->seq) != gen); // Wait for a new generation
+    }while(ret == 0);
+
+    if(start != 0) add_latency(tag, HIST_BLOCKED, ktime_get_ns() - start);
+
+    leave_level(tag, p, num, NULL);
+
+    if(slot != NULL){
+        add_stat(tag, p, STAT_DELIVERED, 1);
+        add_stat(tag, p, STAT_BYTES, (*message)->size);
+        return 0;
+    }
+
+    if(ret == -EINVAL) printk(KERN_ERR "%s: Level %d doesn't keep its history nor retains its last message\n", MODNAME, num);
+
+    if(ret == -ERESTARTSYS){
+        printk(KERN_ERR "%s: Process %d woken up by signal\n", MODNAME, current->pid);
+        add_stat(tag, p, STAT_SIGNALS, 1);
+    }
+
+    return ret;
+}
+
+/* Wakes up all threads waiting on the tag service
+ *
+ * tag = tag service whose levels should be awakened
+ *
+ */
+int wakeup_all(struct tag_t *tag){
+    struct level_t *p;
+    struct small_message_t small;
+    struct message_t *message;
+    unsigned long i;
+
+    message = init_small_message(&small, 0); // Empty message
+
+    rcu_read_lock();
+
+    // Only levels with waiting threads
+    for_each_set_bit(i, tag->active, MAX_LV){
+        p = rcu_dereference(tag->levels[i]);
+        if(p != NULL) publish_message(p, message, 0); // Not kept in the history nor in mailboxes
     }
 
     rcu_read_unlock();
     return 0;
 }
 
-/* Forcefully removes all levels in the list
+/* Sends message to all waiting threads from level waking them up
+ *
+ * tag = tag service owning the level
+ * num = level number
+ * message = message to be sent
  *
- * lv_head = head of the list
- * lock = list write lock
+ * Returns 1 if the message was delivered or kept, 0 if it was discarded.
  *
  */
-int force_cleanup(struct list_head *lv_head, spinlock_t lock){
+int wakeup_level(struct tag_t *tag, int num, struct message_t *message){
     struct level_t *p;
+    int ret;
+
+    ret = 0;
 
     rcu_read_lock();
 
-    list_for_each_entry(p, lv_head, list){
+    p = rcu_dereference(tag->levels[num]);
 
-        spin_lock(&lock);
-        list_del_rcu(&p->list); // Remove element
-        spin_unlock(&lock);
+    // Message discarded if nobody is waiting and the level doesn't keep it
+    if(p != NULL && search_level(tag, num) == 0) ret = publish_message(p, message, 1);
 
-        rcu_read_unlock();
-        synchronize_rcu();
-        kfree(p); // Reclaim space
-        rcu_read_lock();
+    add_stat(tag, p, STAT_SENT, 1);
+    if(ret == 0) add_stat(tag, p, STAT_DISCARDED, 1);
+
+    rcu_read_unlock();
+
+    return ret;
+}
+
+/* Accounts a message sent to a level and discarded before publishing it because no thread was waiting
+ *
+ * tag = tag service owning the level
+ * num = level number
+ *
+ */
+void discard_message(struct tag_t *tag, int num){
+    struct level_t *p;
+
+    rcu_read_lock();
+
+    p = rcu_dereference(tag->levels[num]);
+
+    add_stat(tag, p, STAT_SENT, 1);
+    add_stat(tag, p, STAT_DISCARDED, 1);
+
+    rcu_read_unlock();
+}
+
+/* Sends message to all waiting threads from a set of levels waking them up
+ *
+ * tag = tag service owning the levels
+ * mask = bitmask of level numbers
+ * message = message to be sent
+ *
+ */
+int wakeup_mask(struct tag_t *tag, unsigned long mask, struct message_t *message){
+    struct level_t *p;
+    unsigned long i;
+    int sent, ret;
+
+    sent = 0;
+
+    rcu_read_lock();
+
+    // Only requested levels with waiting threads or keeping messages, the table is walked once
+    for_each_set_bit(i, &mask, MAX_LV){
+        p = rcu_dereference(tag->levels[i]);
+        ret = 0;
+
+        if(p != NULL && search_level(tag, i) == 0) ret = publish_message(p, message, 1);
+
+        add_stat(tag, p, STAT_SENT, 1);
+        if(ret == 0) add_stat(tag, p, STAT_DISCARDED, 1);
+
+        sent += ret;
     }
 
     rcu_read_unlock();
+
+    return sent;
+}
+
+/* Reclaims level's space once a grace period has elapsed since it was unlinked
+ *
+ * head = rcu head of the level
+ *
+ */
+static void free_level(struct rcu_head *head){
+    struct level_t *level;
+
+    level = container_of(head, struct level_t, rcu);
+
+    put_message(level->message);
+    free_history(level->history, level->depth);
+    put_message(level->last.message);
+    free_stats(level->stats);
+    kmem_cache_free(level_cache, level);
+}
+
+/* Unlinks all levels of the tag service, must be called holding the level table lock
+ *
+ * tag = tag service whose levels should be removed
+ *
+ */
+static void remove_levels(struct tag_t *tag){
+    struct level_t *p;
+    int i;
+
+    for(i=0; i<MAX_LV; i++){
+
+        p = rcu_dereference_protected(tag->levels[i], lockdep_is_held(&tag->lv_lock));
+        if(p == NULL) continue;
+
+        RCU_INIT_POINTER(tag->levels[i], NULL); // Remove element
+        call_rcu(&p->rcu, free_level); // Reclaim space after a single grace period shared by all levels
+    }
+}
+
+/* Removes all levels of the tag service if no thread is currently waiting
+ *
+ * tag = tag service whose levels should be removed
+ *
+ */
+int cleanup_levels(struct tag_t *tag){
+
+    spin_lock(&tag->lv_lock);
+
+    // Check every level before removing any of them
+    if(!bitmap_empty(tag->active, MAX_LV)){
+        spin_unlock(&tag->lv_lock);
+        printk(KERN_ERR "%s: Unable to remove levels, threads are still waiting for message\n", MODNAME);
+        return -1;
+    }
+
+    remove_levels(tag);
+
+    spin_unlock(&tag->lv_lock);
     return 0;
-}
\ No newline at end of file
+}
+
+/* Forcefully removes all levels of the tag service
+ *
+ * tag = tag service whose levels should be removed
+ *
+ */
+int force_cleanup(struct tag_t *tag){
+
+    spin_lock(&tag->lv_lock);
+    remove_levels(tag);
+    spin_unlock(&tag->lv_lock);
+
+    return 0;
+}
@@ -0,0 +1,154 @@
+/* ---------------------------------------------------------------------------------------------------------------------
+ MESSAGE
+
+ This module implements a reference counted message ( see /include/struct.h for struct message_t). A single message is
+ allocated by the sender and shared by all the threads receiving it, the last one to release it reclaims its space.
+ Messages up to INLINE_SIZE bytes are instead carried inline and copied, so they never touch the allocator.
+--------------------------------------------------------------------------------------------------------------------- */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mempool.h>
+#include <linux/atomic.h>
+#include <linux/string.h>
+#include <linux/wait.h>
+#include <linux/types.h>
+#include "../include/message.h"
+#include "../include/struct.h"
+#include "../config.h"
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Lisa Trombetti <lisa.trombetti96@gmail.com>");
+MODULE_DESCRIPTION("MESSAGE");
+
+#define MODNAME "MESSAGE"
+
+
+// Size classes above INLINE_SIZE, each one with its own cache and a reserve of messages so that sending can't fail
+#define CLASSES 3
+#define CLASS_SIZE(class) (MAX_SIZE >> (2*(CLASSES - 1 - (class))))   // Payload capacity, up to MAX_SIZE
+
+static struct kmem_cache *message_cache[CLASSES];
+static mempool_t *message_pool[CLASSES];
+
+static const char *cache_names[CLASSES] = {"tag_message_s", "tag_message_m", "tag_message_l"};
+
+
+/* Creates message caches and their reserves */
+int init_message_caches(void){
+    int i;
+
+    BUILD_BUG_ON(CLASS_SIZE(0) <= INLINE_SIZE); // Smaller messages are carried inline, a class for them would be unused
+
+    for(i=0; i<CLASSES; i++){
+
+        // Payload is binary, its length is kept in the header
+        message_cache[i] = kmem_cache_create(cache_names[i], sizeof(struct message_t) + CLASS_SIZE(i), 0, SLAB_HWCACHE_ALIGN, NULL);
+        if(message_cache[i] == NULL){
+            printk(KERN_ERR "%s: Unable to create message cache %s\n", MODNAME, cache_names[i]);
+            destroy_message_caches();
+            return -ENOMEM;
+        }
+
+        message_pool[i] = mempool_create_slab_pool(MSG_RESERVE, message_cache[i]);
+        if(message_pool[i] == NULL){
+            printk(KERN_ERR "%s: Unable to create message reserve for %s\n", MODNAME, cache_names[i]);
+            destroy_message_caches();
+            return -ENOMEM;
+        }
+    }
+
+    return 0;
+}
+
+/* Destroys message caches and their reserves, all messages must have been released */
+void destroy_message_caches(void){
+    int i;
+
+    for(i=0; i<CLASSES; i++){
+        if(message_pool[i] != NULL) mempool_destroy(message_pool[i]);
+        if(message_cache[i] != NULL) kmem_cache_destroy(message_cache[i]);
+
+        message_pool[i] = NULL;
+        message_cache[i] = NULL;
+    }
+}
+
+/* Allocates a new message, the reference returned belongs to the caller
+ *
+ * size = message's size, at most MAX_SIZE
+ *
+ */
+struct message_t *alloc_message(size_t size){
+    struct message_t *new;
+    int class;
+
+    // Smallest class fitting the message
+    for(class=0; class<CLASSES-1 && CLASS_SIZE(class) < size; class++);
+
+    // Allocate message and its content at once, waits on the reserve instead of failing
+    new = (struct message_t *)mempool_alloc(message_pool[class], GFP_KERNEL);
+    if(new == NULL){
+        printk(KERN_ERR "%s: Unable to allocate new message of size %zu\n", MODNAME, size);
+        return NULL;
+    }
+
+    atomic_set(&new->refs, 1);
+    new->class = class;
+    new->size = size;
+
+    return new;
+}
+
+/* Initializes a message carried inline, no heap allocation is involved
+ *
+ * small = storage for the message
+ * size = message's size, at most INLINE_SIZE
+ *
+ */
+struct message_t *init_small_message(struct small_message_t *small, size_t size){
+
+    atomic_set(&small->head.refs, 1);
+    small->head.class = MSG_INLINE;
+    small->head.size = size;
+
+    return &small->head;
+}
+
+/* Copies a message carried inline to new storage
+ *
+ * small = storage for the copy
+ * message = message carried inline to be copied
+ *
+ */
+struct message_t *copy_small_message(struct small_message_t *small, struct message_t *message){
+
+    init_small_message(small, message->size);
+    memcpy(small->head.buffer, message->buffer, message->size);
+
+    return &small->head;
+}
+
+/* Takes a new reference to the message
+ *
+ * message = message to be shared
+ *
+ */
+struct message_t *get_message(struct message_t *message){
+    atomic_inc(&message->refs);
+    return message;
+}
+
+/* Releases a reference to the message, reclaiming its space when the last one is dropped
+ *
+ * message = message to be released
+ *
+ */
+void put_message(struct message_t *message){
+
+    // Messages carried inline are owned by their storage
+    if(message == NULL || message->class == MSG_INLINE) return;
+
+    if(atomic_dec_and_test(&message->refs)) mempool_free(message, message_pool[message->class]); // Last reader
+}
\ No newline at end of file
@@ -10,10 +10,20 @@
 #include <linux/slab.h>
 #include <linux/cred.h>
 #include <linux/uaccess.h>
+#include <linux/fcntl.h>
 #include "../include/service.h"
 #include "../include/tag.h"
+#include "../include/level.h"
+#include "../include/message.h"
+#include "../include/waitset.h"
+#include "../include/tagfd.h"
+#include "../include/subscription.h"
+#include "../include/struct.h"
 #include "../config.h"
 
+#define CREATE_TRACE_POINTS
+#include "../include/tag_trace.h"
+
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Lisa Trombetti <lisa.trombetti96@gmail.com>");
 MODULE_DESCRIPTION("SERVICE");
@@ -26,12 +36,46 @@ MODULE_DESCRIPTION("SERVICE");
 #define AWAKE_ALL 3
 #define REMOVE 4
 
+// Wait set command numbers
+#define WS_CREATE 1
+#define WS_ADD 2
+#define WS_REMOVE 3
+
+// Level command numbers
+#define LV_HISTORY 1
+#define LV_RETAIN 2
+
+#define DEST_CHUNK 16   // Destinations of tag_send_multi copied from user space at once
+
 
 // INIT AND CLEANUP ----------------------------------------------------------------------------------------------------
 
+int init_service(void){
+
+    if(init_message_caches() < 0) return -1;
+
+    if(init_level_cache() < 0){
+        destroy_message_caches();
+        return -1;
+    }
+
+    if(init_tag_cache() < 0){
+        destroy_level_cache();
+        destroy_message_caches();
+        return -1;
+    }
+
+    printk("%s: Service initialized\n", MODNAME);
+    return 0;
+}
+
 void cleanup_service(void){
     printk("%s: Shutting down service\n", MODNAME);
-    cleanup_tags();
+    cleanup_tags(); // Waits for pending reclamation
+
+    destroy_tag_cache();
+    destroy_level_cache();
+    destroy_message_caches();
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
@@ -42,8 +86,6 @@ int tag_get(int key, int command, int permission){
 
     private = 1; // By default service it's private
 
-    printk(KERN_DEBUG "%s: tag_get called with params %d - %d - %d\n", MODNAME, key, command, permission);
-
     if(command == CREATE){
         // Valid key values can only be integer numbers >= 0
         if(key < 0){
@@ -56,7 +98,8 @@ int tag_get(int key, int command, int permission){
         // Try to insert new tag
         desc = insert_tag(key, private, (uid_t)permission);
 
-        desc < 0 ? printk("%s: Unable to create new tag service with key %d\n", MODNAME, key) : printk("%s: New tag service %d created\n", MODNAME, desc);
+        if(desc < 0) printk(KERN_ERR "%s: Unable to create new tag service with key %d\n", MODNAME, key);
+        trace_tag_get(key, command, desc);
 
         return desc;
     }
@@ -65,7 +108,8 @@ int tag_get(int key, int command, int permission){
         // Try to open tag
         desc = open_tag(key, (uid_t)permission);
 
-        desc < 0 ? printk("%s: Unable to open tag service with key %d\n", MODNAME, key) : printk("%s: Tag service %d opened by process %d\n", MODNAME, desc, current->pid);
+        if(desc < 0) printk(KERN_ERR "%s: Unable to open tag service with key %d\n", MODNAME, key);
+        trace_tag_get(key, command, desc);
 
         return desc;
     }
@@ -75,9 +119,91 @@ int tag_get(int key, int command, int permission){
 }
 
 
+/* Checks that a level mask selects at least one valid level
+ *
+ * mask = bitmask of level numbers
+ *
+ */
+static int check_mask(unsigned long mask){
+
+    BUILD_BUG_ON(MAX_LV > BITS_PER_LONG); // Every level must fit in the mask
+
+    if(mask == 0 || (MAX_LV < BITS_PER_LONG && (mask >> MAX_LV) != 0)){
+        printk(KERN_ERR "%s: Level mask %#lx must select levels in range [0,%d]\n", MODNAME, mask, MAX_LV);
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+/* Copies a message to be sent from user space
+ *
+ * buffer = user space buffer holding the message
+ * size = message's size
+ * small = storage used if the message is small enough to be carried inline
+ *
+ */
+static struct message_t *copy_message(char *buffer, size_t size, struct small_message_t *small){
+    struct message_t *message;
+
+    if(size <= INLINE_SIZE){
+        // Small message carried inline, it doesn't need any allocation
+        message = init_small_message(small, size);
+    }
+    else{
+        // Allocate the message shared by all receivers
+        message = alloc_message(size);
+        if(message == NULL){
+            return NULL;
+        }
+    }
+
+    // Copy message to be sent
+    if(copy_from_user(message->buffer, buffer, size)){
+        printk(KERN_ERR "%s: Error copying message from user space\n",MODNAME);
+        put_message(message);
+        return NULL;
+    }
+
+    return message;
+}
+
+/* Sends a message already copied from user space to a level of a tag service
+ *
+ * tag = tag service descriptor
+ * level = level number
+ * perm = user id for permission check
+ * message = message to be sent
+ *
+ * Returns 1 if the message was delivered or kept by the level, 0 if it was discarded because nobody was waiting.
+ *
+ */
+static int send_message(int tag, int level, uid_t perm, struct message_t *message){
+    int ret;
+
+    // Check level number
+    if(level < 0 || level >= MAX_LV){
+        printk(KERN_ERR "%s: Level number %d it's out of range [0,%d]\n", MODNAME, level, MAX_LV);
+        return -EINVAL;
+    }
+
+    // Send message
+    ret = wakeup_tag_level(tag, level, perm, message);
+    if(ret < 0){
+        printk(KERN_ERR "%s: Unable to send message to tag service %d level %d\n", MODNAME, tag, level);
+        trace_tag_send(tag, level, message->size, -1);
+        return -1;
+    }
+
+    trace_tag_send(tag, level, message->size, 0);
+    return ret;
+}
+
+
 int tag_send(int tag, int level, char *buffer, size_t size){
     int ret;
-    char *copied;
+    struct small_message_t small;
+    struct message_t *message;
     uid_t perm;
 
     perm = current_uid().val;
@@ -88,94 +214,396 @@ int tag_send(int tag, int level, char *buffer, size_t size){
         return -EINVAL;
     }
 
-    if(size == 0){
-        // Empty buffer it's allowed buf size can't be zero
-        size = 1;
+    // Check level number
+    if(level < 0 || level >= MAX_LV){
+        printk(KERN_ERR "%s: Level number %d it's out of range [0,%d]\n", MODNAME, level, MAX_LV);
+        return -EINVAL;
     }
 
-    copied = (char *)kmalloc(size*sizeof(char), GFP_KERNEL);
-
-    // Copy message to be sent
-    ret = copy_from_user((char*)copied,(char*)buffer,size);
+    // Nobody is waiting, the message would be discarded anyway
+    ret = tag_level_waiting(tag, level, perm);
     if(ret < 0){
-        printk(KERN_ERR "%s: Error copying message from user space\n",MODNAME);
-        kfree(copied);
+        printk(KERN_ERR "%s: Unable to send message to tag service %d level %d\n", MODNAME, tag, level);
+        trace_tag_send(tag, level, size, -1);
         return -1;
     }
+    else if(ret == 0){
+        trace_tag_send(tag, level, size, 0); // Nobody to deliver to, message discarded
+        return 0;
+    }
 
-    printk(KERN_DEBUG "%s: tag_send called with params %d - %d - %s - %zu\n", MODNAME, tag, level, copied, size);
+    message = copy_message(buffer, size, &small);
+    if(message == NULL) return -1;
 
-    // Send message
-    if(wakeup_tag_level(tag, level, perm, copied) < 0){
-        printk("%s: Unable to send message to tag service %d level %d\n", MODNAME, tag, level);
-        kfree(copied);
+    ret = send_message(tag, level, perm, message);
+
+    put_message(message); // Receivers hold their own references
+    return ret < 0 ? ret : 0;
+}
+
+
+int tag_send_multi(struct tag_dest_t *dests, int count, char *buffer, size_t size){
+    int i, n, done, sent, ret;
+    struct tag_dest_t chunk[DEST_CHUNK];
+    struct small_message_t small;
+    struct message_t *message;
+    uid_t perm;
+
+    perm = current_uid().val;
+
+    // Check number of destinations, each pair of tag service and level can appear at most once
+    if(count <= 0 || count > MAX_TAGS*MAX_LV){
+        printk(KERN_ERR "%s: Number of destinations %d it's out of range [1,%d]\n", MODNAME, count, MAX_TAGS*MAX_LV);
+        return -EINVAL;
+    }
+
+    // Check message's size
+    if(size > MAX_SIZE){
+        printk(KERN_ERR "%s: Maximum size of %d exceeded by message\n", MODNAME, MAX_SIZE);
+        return -EINVAL;
+    }
+
+    // Copy message once for all destinations
+    message = copy_message(buffer, size, &small);
+    if(message == NULL) return -1;
+
+    sent = 0;
+
+    // Destinations are copied from user space in chunks so that no allocation is needed
+    for(done=0; done<count; done+=n){
+        n = min(count - done, DEST_CHUNK);
+
+        if(copy_from_user(chunk, dests + done, n*sizeof(struct tag_dest_t))){
+            printk(KERN_ERR "%s: Error copying destinations from user space\n",MODNAME);
+            put_message(message);
+            return -1;
+        }
+
+        for(i=0; i<n; i++){
+            // Destinations accepting the message but discarding it succeed without being counted as delivered
+            ret = send_message(chunk[i].tag, chunk[i].level, perm, message);
+            chunk[i].ret = ret < 0 ? ret : 0;
+            if(ret > 0) sent++;
+        }
+
+        // Return result of each destination
+        if(copy_to_user(dests + done, chunk, n*sizeof(struct tag_dest_t))){
+            printk(KERN_ERR "%s: Error copying results to user space\n",MODNAME);
+            put_message(message);
+            return -1;
+        }
+    }
+
+    put_message(message); // Receivers hold their own references
+    return sent;
+}
+
+
+int tag_send_mask(int tag, unsigned long mask, char *buffer, size_t size){
+    int ret;
+    struct small_message_t small;
+    struct message_t *message;
+    uid_t perm;
+
+    perm = current_uid().val;
+
+    // Check level mask
+    if(check_mask(mask) < 0) return -EINVAL;
+
+    // Check message's size
+    if(size > MAX_SIZE){
+        printk(KERN_ERR "%s: Maximum size of %d exceeded by message\n", MODNAME, MAX_SIZE);
+        return -EINVAL;
+    }
+
+    // Copy message once for all levels
+    message = copy_message(buffer, size, &small);
+    if(message == NULL) return -1;
+
+    ret = wakeup_tag_mask(tag, mask, perm, message);
+    if(ret < 0) printk(KERN_ERR "%s: Unable to send message to tag service %d levels %#lx\n", MODNAME, tag, mask);
+
+    trace_tag_send_mask(tag, mask, size, ret);
+
+    put_message(message); // Receivers hold their own references
+    return ret;
+}
+
+
+/* Copies a delivered message to user space and releases it, returns the number of bytes copied
+ *
+ * buffer = user space buffer where the message should be copied
+ * size = buffer's size, longer messages are truncated
+ * message = delivered message
+ *
+ */
+static int receive_message(char *buffer, size_t size, struct message_t *message){
+    size_t len;
+
+    len = min(size, message->size); // Messages are binary, only their length is trusted
+
+    // Copy to user space straight from the sender's message, or from the inline copy for small ones
+    if(copy_to_user((char*)buffer, message->buffer, len)){
+        printk(KERN_ERR "%s: Error copying message to user space\n",MODNAME);
+        put_message(message);
         return -1;
     }
 
-    printk("%s: Message successfully sent to tag service %d level %d\n", MODNAME, tag, level);
-    kfree(copied);
-    return 0;
+    put_message(message);
+    return len;
 }
 
 
 int tag_receive(int tag, int level, char *buffer, size_t size){
+    struct small_message_t small;
+    struct message_t *message;
+    uid_t perm;
     int ret;
-    char *message;
+
+    perm = current_uid().val;
+
+    // Wait for message
+    if(wait_tag_message(tag, level, perm, &message, &small) < 0) {
+        printk(KERN_ERR "%s: Unable to receive new message from tag service %d level %d\n", MODNAME, tag, level);
+        trace_tag_receive_wake(tag, level, -1);
+        return -1;
+    }
+
+    ret = receive_message(buffer, size, message);
+    trace_tag_receive_wake(tag, level, ret);
+
+    return ret;
+}
+
+
+int tag_receive_mask(int tag, unsigned long mask, char *buffer, size_t size, int *level){
+    struct small_message_t small;
+    struct message_t *message;
     uid_t perm;
+    int num, ret;
 
     perm = current_uid().val;
 
-    printk(KERN_DEBUG "%s: tag_receive called with params %d - %d - %zu\n", MODNAME, tag, level, size);
+    // Check level mask
+    if(check_mask(mask) < 0) return -EINVAL;
 
-    // Create new memory location to store the message
-    message = (char *)kmalloc(size*sizeof(char), GFP_KERNEL);
+    // Wait for message on any of the levels
+    if(wait_tag_mask(tag, mask, perm, &num, &message, &small) < 0) {
+        printk(KERN_ERR "%s: Unable to receive new message from tag service %d levels %#lx\n", MODNAME, tag, mask);
+        trace_tag_receive_wake(tag, -1, -1);
+        return -1;
+    }
 
-    // Wait for message
-    if(wait_tag_message(tag, level, perm, message, size) < 0) {
-        printk("%s: Unable to receive new message from tag service %d level %d\n", MODNAME, tag, level);
-        kfree(message);
+    ret = receive_message(buffer, size, message);
+    trace_tag_receive_wake(tag, num, ret);
+    if(ret < 0) return -1;
+
+    // Level the message was delivered on
+    if(put_user(num, level)){
+        printk(KERN_ERR "%s: Error copying level to user space\n",MODNAME);
         return -1;
     }
 
-    // Copy to user space
-    ret = copy_to_user((char*)buffer, (char*)message, min(size, strlen(message)));
+    return ret;
+}
+
+
+int tag_receive_seq(int tag, int level, char *buffer, size_t size, unsigned long *seq, int flags){
+    struct small_message_t small;
+    struct message_t *message;
+    unsigned long last;
+    uid_t perm;
+    int ret;
+
+    perm = current_uid().val;
+
+    // Check flags
+    if(flags & ~O_NONBLOCK){
+        printk(KERN_ERR "%s: Invalid flags %#x, only O_NONBLOCK is allowed\n", MODNAME, flags);
+        return -EINVAL;
+    }
+
+    if(get_user(last, seq)){
+        printk(KERN_ERR "%s: Error copying sequence number from user space\n",MODNAME);
+        return -EFAULT;
+    }
+
+    // Oldest message kept newer than the one already seen, or the one retained
+    ret = read_tag_history(tag, level, perm, &last, flags & O_NONBLOCK, &message, &small);
     if(ret < 0){
-        printk(KERN_ERR "%s: Error copying message to user space\n",MODNAME);
-        kfree(message);
+        if(ret != -EAGAIN && ret != -ECANCELED) printk(KERN_ERR "%s: Unable to read history of tag service %d level %d\n", MODNAME, tag, level);
+        trace_tag_receive_wake(tag, level, ret);
+        return ret;
+    }
+
+    ret = receive_message(buffer, size, message);
+    trace_tag_receive_wake(tag, level, ret);
+    if(ret < 0) return -1;
+
+    // Sequence number of the message read
+    if(put_user(last, seq)){
+        printk(KERN_ERR "%s: Error copying sequence number to user space\n",MODNAME);
         return -1;
     }
 
-    printk("%s: New message successfully sent to process %d", MODNAME, current->pid);
-    kfree(message);
-    return 0;
+    return ret;
 }
 
 
-int tag_ctl(int tag, int command){
+int tag_waitset(int ws, int command, int tag, int level){
+    uid_t perm;
+    int ret;
+
+    perm = current_uid().val;
+
+    switch(command){
+        case WS_CREATE:
+            ret = create_waitset();
+            if(ret < 0) printk(KERN_ERR "%s: Unable to create new wait set\n", MODNAME);
+            return ret;
+
+        case WS_ADD:
+            ret = add_waitset(ws, perm, tag, level);
+            if(ret < 0) printk(KERN_ERR "%s: Unable to add tag service %d level %d to wait set %d\n", MODNAME, tag, level, ws);
+            return ret;
+
+        case WS_REMOVE:
+            ret = remove_waitset(ws, tag, level);
+            if(ret < 0) printk(KERN_ERR "%s: Unable to remove tag service %d level %d from wait set %d\n", MODNAME, tag, level, ws);
+            return ret;
+    }
+
+    printk(KERN_ERR "%s: Wrong command %d, must be one of %d (create), %d (add) or %d (remove)\n", MODNAME, command, WS_CREATE, WS_ADD, WS_REMOVE);
+    return -EINVAL;
+}
+
+
+int tag_waitset_wait(int ws, struct tag_event_t *event, char *buffer, size_t size){
+    struct small_message_t small;
+    struct message_t *message;
+    struct tag_event_t ev;
     uid_t perm;
+    int ret;
 
     perm = current_uid().val;
 
-    printk(KERN_DEBUG "%s: tag_ctl called with params %d - %d\n", MODNAME, tag, command);
+    // Wait for message on any pair of tag service and level
+    if(waitset_wait(ws, perm, &ev, &message, &small) < 0) {
+        printk(KERN_ERR "%s: Unable to receive new message from wait set %d\n", MODNAME, ws);
+        return -1;
+    }
+
+    ret = receive_message(buffer, size, message);
+    trace_tag_receive_wake(ev.tag, ev.level, ret);
+    if(ret < 0) return -1;
+
+    // Tag service and level the message was delivered on
+    if(copy_to_user(event, &ev, sizeof(struct tag_event_t))){
+        printk(KERN_ERR "%s: Error copying event to user space\n",MODNAME);
+        return -1;
+    }
+
+    return ret;
+}
+
+
+int tag_fd(int tag, int level, int flags){
+    int fd;
+    uid_t perm;
+
+    perm = current_uid().val;
+
+    fd = create_tag_fd(tag, level, perm, flags);
+
+    if(fd < 0) printk(KERN_ERR "%s: Unable to create file descriptor for tag service %d level %d\n", MODNAME, tag, level);
+
+    return fd;
+}
+
+
+int tag_subscribe(int tag, int level, int depth, int policy, int flags){
+    int fd;
+    uid_t perm;
+
+    perm = current_uid().val;
+
+    // Check mailbox depth
+    if(depth <= 0){
+        printk(KERN_ERR "%s: Mailbox depth %d must be > 0\n", MODNAME, depth);
+        return -EINVAL;
+    }
+
+    fd = create_subscription(tag, level, perm, (unsigned int)depth, policy, flags);
+
+    if(fd < 0) printk(KERN_ERR "%s: Unable to subscribe to tag service %d level %d\n", MODNAME, tag, level);
+
+    return fd;
+}
+
+
+int tag_level_ctl(int tag, int level, int command, int arg){
+    uid_t perm;
+    int ret;
+
+    perm = current_uid().val;
+
+    if(command == LV_HISTORY){
+        // Check history depth
+        if(arg < 0 || arg > MAX_HISTORY){
+            printk(KERN_ERR "%s: History depth %d it's out of range [0,%d]\n", MODNAME, arg, MAX_HISTORY);
+            return -EINVAL;
+        }
+
+        ret = tag_level_history(tag, level, perm, (unsigned int)arg);
+        if(ret < 0) printk(KERN_ERR "%s: Unable to set history of tag service %d level %d\n", MODNAME, tag, level);
+
+        trace_tag_ctl(tag, command, ret);
+        return ret;
+    }
+    else if(command == LV_RETAIN){
+        // Check retain flag
+        if(arg != 0 && arg != 1){
+            printk(KERN_ERR "%s: Retain flag %d must be either 0 or 1\n", MODNAME, arg);
+            return -EINVAL;
+        }
+
+        ret = tag_level_retain(tag, level, perm, arg);
+        if(ret < 0) printk(KERN_ERR "%s: Unable to set retain flag of tag service %d level %d\n", MODNAME, tag, level);
+
+        trace_tag_ctl(tag, command, ret);
+        return ret;
+    }
+
+    printk(KERN_ERR "%s: Wrong command %d, must be either %d (history) or %d (retain)\n", MODNAME, command, LV_HISTORY, LV_RETAIN);
+    return -EINVAL;
+}
+
+
+int tag_ctl(int tag, int command){
+    uid_t perm;
+
+    perm = current_uid().val;
 
     if(command == AWAKE_ALL){
         // Awake all sleeping threads
         if(wakeup_tag_level(tag, -1, perm, NULL) < 0){
-            printk("%s: Unable to awake all threads for tag service %d\n", MODNAME, tag);
+            printk(KERN_ERR "%s: Unable to awake all threads for tag service %d\n", MODNAME, tag);
+            trace_tag_ctl(tag, command, -1);
             return -1;
         }
 
-        printk("%s: All threads awakened for tag service %d\n", MODNAME, tag);
+        trace_tag_ctl(tag, command, 0);
         return 0;
     }
     else if(command == REMOVE){
         // Delete tag
         if(delete_tag(tag, perm) < 0){
-            printk("%s: Unable to remove tag service %d\n", MODNAME, tag);
+            printk(KERN_ERR "%s: Unable to remove tag service %d\n", MODNAME, tag);
+            trace_tag_ctl(tag, command, -1);
             return -1;
         }
 
-        printk("%s: Tag service %d successfully removed\n", MODNAME, tag);
+        trace_tag_ctl(tag, command, 0);
         return 0;
     }
 
@@ -0,0 +1,148 @@
+/* ---------------------------------------------------------------------------------------------------------------------
+ STATS
+
+ This module implements the traffic counters of tag services and levels and the latency histograms of tag services
+ ( see /include/struct.h for struct tag_stats_t and tag_hist_t). Both are per cpu, so that updating them on the fast
+ path doesn't share cachelines, and they're summed up only when read.
+--------------------------------------------------------------------------------------------------------------------- */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/string.h>
+#include <linux/bitops.h>
+#include "../include/stats.h"
+#include "../include/struct.h"
+#include "../config.h"
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Lisa Trombetti <lisa.trombetti96@gmail.com>");
+MODULE_DESCRIPTION("STATS");
+
+#define MODNAME "STATS"
+
+
+/* Allocates new zeroed counters */
+struct tag_stats_t __percpu *alloc_stats(void){
+    struct tag_stats_t __percpu *stats;
+
+    stats = alloc_percpu(struct tag_stats_t);
+    if(stats == NULL) printk(KERN_ERR "%s: Unable to allocate new counters\n", MODNAME);
+
+    return stats;
+}
+
+/* Frees counters
+ *
+ * stats = counters returned by alloc_stats
+ *
+ */
+void free_stats(struct tag_stats_t __percpu *stats){
+    free_percpu(stats);
+}
+
+/* Adds to a counter of a tag service and of one of its levels
+ *
+ * tag = tag service
+ * level = level, NULL if the event isn't related to an existing level
+ * stat = counter to be updated
+ * n = amount to be added
+ *
+ */
+void add_stat(struct tag_t *tag, struct level_t *level, int stat, u64 n){
+
+    this_cpu_add(tag->stats->count[stat], n);
+
+    if(level != NULL) this_cpu_add(level->stats->count[stat], n);
+}
+
+/* Sums up the counters of every cpu
+ *
+ * stats = counters to be read
+ * sum = where to store the totals
+ *
+ */
+void read_stats(struct tag_stats_t __percpu *stats, struct tag_stats_t *sum){
+    struct tag_stats_t *p;
+    int cpu, i;
+
+    memset(sum, 0, sizeof(struct tag_stats_t));
+
+    for_each_possible_cpu(cpu){
+        p = per_cpu_ptr(stats, cpu);
+
+        for(i=0; i<STATS; i++){
+            sum->count[i] += READ_ONCE(p->count[i]);
+        }
+    }
+}
+
+/* Allocates new zeroed histograms */
+struct tag_hist_t __percpu *alloc_hist(void){
+    struct tag_hist_t __percpu *hist;
+
+    hist = alloc_percpu(struct tag_hist_t);
+    if(hist == NULL) printk(KERN_ERR "%s: Unable to allocate new histograms\n", MODNAME);
+
+    return hist;
+}
+
+/* Frees histograms
+ *
+ * hist = histograms returned by alloc_hist
+ *
+ */
+void free_hist(struct tag_hist_t __percpu *hist){
+    free_percpu(hist);
+}
+
+/* Records a latency in a histogram of a tag service
+ *
+ * tag = tag service
+ * hist = histogram to be updated
+ * ns = latency in nanoseconds
+ *
+ */
+void add_latency(struct tag_t *tag, int hist, u64 ns){
+    int bucket;
+
+    bucket = min(fls64(ns), HIST_BUCKETS - 1); // Bucket i holds [2^(i-1), 2^i)
+
+    this_cpu_inc(tag->hist->count[hist][bucket]);
+}
+
+/* Sums up the histograms of every cpu
+ *
+ * hist = histograms to be read
+ * sum = where to store the totals
+ *
+ */
+void read_hist(struct tag_hist_t __percpu *hist, struct tag_hist_t *sum){
+    struct tag_hist_t *p;
+    int cpu, i, j;
+
+    memset(sum, 0, sizeof(struct tag_hist_t));
+
+    for_each_possible_cpu(cpu){
+        p = per_cpu_ptr(hist, cpu);
+
+        for(i=0; i<HISTS; i++){
+            for(j=0; j<HIST_BUCKETS; j++){
+                sum->count[i][j] += READ_ONCE(p->count[i][j]);
+            }
+        }
+    }
+}
+
+/* Resets the histograms of every cpu, latencies recorded concurrently may be lost
+ *
+ * hist = histograms to be reset
+ *
+ */
+void reset_hist(struct tag_hist_t __percpu *hist){
+    int cpu;
+
+    for_each_possible_cpu(cpu){
+        memset(per_cpu_ptr(hist, cpu), 0, sizeof(struct tag_hist_t));
+    }
+}
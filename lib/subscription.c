@@ -0,0 +1,240 @@
+/* ---------------------------------------------------------------------------------------------------------------------
+ SUBSCRIPTION
+
+ This module implements persistent subscriptions to a level of a tag service ( see /include/struct.h for struct sub_t).
+ A subscription is registered on the level once and gets every message published on it in its own mailbox, which is
+ then drained by reading the file descriptor returned, so that no message is lost between two receives. With the
+ SUB_SHARED policy the mailbox is instead a ring mapped in user space ( see /include/tag_ring.h), which senders write
+ into directly, so that receivers only enter the kernel to sleep with poll when the ring is empty.
+--------------------------------------------------------------------------------------------------------------------- */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/version.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/anon_inodes.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/uaccess.h>
+#include "../include/subscription.h"
+#include "../include/tag.h"
+#include "../include/level.h"
+#include "../include/message.h"
+#include "../include/stats.h"
+#include "../include/struct.h"
+#include "../config.h"
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Lisa Trombetti <lisa.trombetti96@gmail.com>");
+MODULE_DESCRIPTION("SUBSCRIPTION");
+
+#define MODNAME "SUBSCRIPTION"
+
+
+/* Reads the oldest message in the mailbox, blocks unless the file is non blocking and fails with -ECANCELED if
+ * AWAKE_ALL wakes it up with the mailbox still empty
+ */
+static ssize_t sub_read(struct file *file, char __user *buf, size_t count, loff_t *off){
+    struct sub_t *sub = file->private_data;
+    struct small_message_t small;
+    struct message_t *message;
+    unsigned long woken;
+    size_t len;
+
+    // Messages in the ring are read from user space
+    if(sub->ring != NULL) return -EINVAL;
+
+    woken = READ_ONCE(sub->level->awake); // Before looking at the mailbox, so that no wakeup is missed
+
+    while(take_mailbox(sub, &message, &small) == 0){
+        if(file->f_flags & O_NONBLOCK) return -EAGAIN;
+
+        if(READ_ONCE(sub->level->awake) != woken) return -ECANCELED;
+
+        // Wait for the mailbox to be filled or for AWAKE_ALL
+        if(wait_event_interruptible(sub->level->wq, READ_ONCE(sub->count) > 0 || READ_ONCE(sub->level->awake) != woken)){
+            add_stat(sub->tag, sub->level, STAT_SIGNALS, 1);
+            return -ERESTARTSYS;
+        }
+    }
+
+    len = min(count, message->size);
+
+    if(copy_to_user(buf, message->buffer, len)){
+        printk(KERN_ERR "%s: Error copying message to user space\n", MODNAME);
+        put_message(message);
+        return -EFAULT;
+    }
+
+    put_message(message);
+    return len;
+}
+
+/* Readable while the mailbox, or the ring, isn't empty */
+static __poll_t sub_poll(struct file *file, poll_table *wait){
+    struct sub_t *sub = file->private_data;
+    int ready;
+
+    poll_wait(file, &sub->level->wq, wait); // Woken up by senders together with blocked receivers
+
+    if(sub->ring != NULL) ready = READ_ONCE(sub->ring->head) != READ_ONCE(sub->tail);
+    else ready = READ_ONCE(sub->count) > 0;
+
+    return ready ? EPOLLIN | EPOLLRDNORM : 0;
+}
+
+/* Maps the ring shared with user space from its start, a first page can be mapped alone to read the ring layout */
+static int sub_mmap(struct file *file, struct vm_area_struct *vma){
+    struct sub_t *sub = file->private_data;
+
+    if(sub->ring == NULL || vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start > sub->ring_size) return -EINVAL;
+
+    // The receiver releases slots writing head, private copies would never reach the module
+    if(!(vma->vm_flags & VM_SHARED)) return -EINVAL;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,3,0)
+    vm_flags_set(vma, VM_DONTEXPAND | VM_DONTDUMP);
+#else
+    vma->vm_flags |= VM_DONTEXPAND | VM_DONTDUMP;
+#endif
+
+    return remap_vmalloc_range(vma, sub->ring, 0);
+}
+
+/* Unsubscribes once the last reference to the file is gone */
+static int sub_release(struct inode *inode, struct file *file){
+    struct sub_t *sub = file->private_data;
+
+    unsubscribe_level(sub->tag, sub);
+    uncheck_tag(sub->tag);
+    kvfree(sub->box);
+    vfree(sub->ring);
+    kfree(sub);
+
+    return 0;
+}
+
+static const struct file_operations sub_fops = {
+    .owner = THIS_MODULE,
+    .read = sub_read,
+    .poll = sub_poll,
+    .mmap = sub_mmap,
+    .release = sub_release
+};
+
+/* Creates a new subscription to a level of a tag service and returns its file descriptor
+ *
+ * desc = descriptor of the tag
+ * level = level number
+ * uid = user id for permission check
+ * depth = number of messages the mailbox can hold, at most MAX_MAILBOX, or MAX_RING for a ring
+ * policy = what to drop when the mailbox is full, SUB_DROP_OLDEST or SUB_DROP_NEWEST, or SUB_SHARED for a ring
+ * flags = O_NONBLOCK and O_CLOEXEC are accepted
+ *
+ */
+int create_subscription(int desc, int level, uid_t uid, unsigned int depth, int policy, int flags){
+    struct sub_t *sub;
+    struct tag_t *tag;
+    int fd;
+
+    // Check level number
+    if(level < 0 || level >= MAX_LV){
+        printk(KERN_ERR "%s: Level number %d it's out of range [0,%d]\n", MODNAME, level, MAX_LV);
+        return -EINVAL;
+    }
+
+    if(depth == 0 || depth > MAX_MAILBOX){
+        printk(KERN_ERR "%s: Mailbox depth %u it's out of range [1,%d]\n", MODNAME, depth, MAX_MAILBOX);
+        return -EINVAL;
+    }
+
+    if(policy != SUB_DROP_OLDEST && policy != SUB_DROP_NEWEST && policy != SUB_SHARED){
+        printk(KERN_ERR "%s: Invalid overflow policy %d\n", MODNAME, policy);
+        return -EINVAL;
+    }
+
+    // Every slot of a ring fits the largest message, so rings are kept shorter than mailboxes
+    if(policy == SUB_SHARED && depth > MAX_RING){
+        printk(KERN_ERR "%s: Ring depth %u it's out of range [1,%d]\n", MODNAME, depth, MAX_RING);
+        return -EINVAL;
+    }
+
+    if(flags & ~(O_NONBLOCK | O_CLOEXEC)){
+        printk(KERN_ERR "%s: Invalid flags %#x\n", MODNAME, flags);
+        return -EINVAL;
+    }
+
+    sub = (struct sub_t *)kmalloc(sizeof(struct sub_t), GFP_KERNEL);
+    if(sub == NULL){
+        printk(KERN_ERR "%s: Unable to allocate new subscription\n", MODNAME);
+        return -ENOMEM;
+    }
+
+    sub->box = NULL;
+    sub->ring = NULL;
+    sub->ring_size = 0;
+
+    if(policy == SUB_SHARED){
+        // Zeroed and mappable in user space, slots are large enough for any message
+        sub->ring_size = PAGE_ALIGN(RING_OFFSET + (size_t)depth*RING_SLOT_SIZE);
+        sub->ring = (struct tag_ring *)vmalloc_user(sub->ring_size);
+        if(sub->ring != NULL){
+            sub->ring->slots = depth;
+            sub->ring->slot_size = RING_SLOT_SIZE;
+            sub->ring->offset = RING_OFFSET;
+        }
+    }
+    else{
+        sub->box = (struct history_t *)kvcalloc(depth, sizeof(struct history_t), GFP_KERNEL);
+    }
+
+    if(sub->box == NULL && sub->ring == NULL){
+        printk(KERN_ERR "%s: Unable to allocate mailbox of %u messages\n", MODNAME, depth);
+        kfree(sub);
+        return -ENOMEM;
+    }
+
+    sub->desc = desc;
+    sub->policy = policy;
+    sub->depth = depth;
+    sub->head = 0;
+    sub->count = 0;
+    sub->tail = 0;
+    spin_lock_init(&sub->lock);
+
+    // The tag service stays checked until the file is released
+    tag = check_tag(desc, uid);
+    if(tag == NULL){
+        kvfree(sub->box);
+        vfree(sub->ring);
+        kfree(sub);
+        return -1;
+    }
+
+    sub->tag = tag;
+
+    if(insert_level(tag, level) < 0) goto fail;
+
+    sub->level = subscribe_level(tag, level, sub);
+    if(sub->level == NULL) goto fail;
+
+    // Rings are mapped writable and shared, which requires a file open for writing
+    fd = anon_inode_getfd("[tag_sub]", &sub_fops, sub, (policy == SUB_SHARED ? O_RDWR : O_RDONLY) | flags);
+    if(fd < 0){
+        unsubscribe_level(tag, sub);
+        goto fail;
+    }
+
+    return fd;
+
+fail:
+    uncheck_tag(tag);
+    kvfree(sub->box);
+    vfree(sub->ring);
+    kfree(sub);
+    return -1;
+}
@@ -11,10 +11,19 @@
 #include <linux/uaccess.h>
 #include <linux/cred.h>
 #include <linux/string.h>
+#include <linux/rcupdate.h>
+#include <linux/hashtable.h>
+#include <linux/bitops.h>
+#include <linux/log2.h>
+#include <linux/percpu-refcount.h>
+#include <linux/completion.h>
 #include "../include/tag.h"
+#include "../include/driver.h"
 #include "../include/level.h"
+#include "../include/stats.h"
 #include "../include/struct.h"
 #include "../config.h"
+#include "../include/tag_trace.h"
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Lisa Trombetti <lisa.trombetti96@gmail.com>");
@@ -23,21 +32,52 @@ MODULE_DESCRIPTION("TAG SERVICE");
 #define MODNAME "TAG SERVICE"
 
 
-static struct tag_t* tags[MAX_TAGS];   // List of tags
-static spinlock_t tag_lock;            // Tag list write lock
+#define TAG_HASH_BITS 8   // Number of bits of the key index, 256 buckets
 
+// Descriptors are made of the index in the list of tags and of the generation of that slot
+#define DESC_BITS order_base_2(MAX_TAGS)
+#define DESC_INDEX(desc) ((desc) & ((1 << DESC_BITS) - 1))
+#define DESC_GEN_MASK (INT_MAX >> DESC_BITS)
+#define MAKE_DESC(index, gen) (((gen) << DESC_BITS) | (index))
 
-/* Search tag by key
+
+static struct tag_t __rcu *tags[MAX_TAGS];      // List of tags
+static unsigned int tag_gen[MAX_TAGS];          // Generation of each slot, bumped every time a service is removed
+static DECLARE_BITMAP(used_desc, MAX_TAGS);     // Descriptors currently in use
+static DEFINE_HASHTABLE(tag_index, TAG_HASH_BITS); // Key to tag index, private tags aren't indexed, readable under RCU
+static DEFINE_SPINLOCK(tag_lock);               // Tag list write lock
+static struct kmem_cache *tag_cache;            // Tag services
+
+
+/* Creates tag cache */
+int init_tag_cache(void){
+
+    tag_cache = kmem_cache_create("tag_service", sizeof(struct tag_t), 0, SLAB_HWCACHE_ALIGN, NULL);
+    if(tag_cache == NULL){
+        printk(KERN_ERR "%s: Unable to create tag cache\n", MODNAME);
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+/* Destroys tag cache, all tags must have been reclaimed */
+void destroy_tag_cache(void){
+    kmem_cache_destroy(tag_cache);
+}
+
+
+/* Search tag by key, must be called holding the tag list lock
  *
  * key = key to be searched
  *
  */
 int search_tag(int key) {
-    int i;
+    struct tag_t *p;
 
-    for(i=0; i<MAX_TAGS; i++) {
+    hash_for_each_possible(tag_index, p, node, key){
         // Key found
-        if(tags[i] != NULL && tags[i]->key == key) return i;
+        if(p->key == key) return p->desc;
     }
 
     return -1;
@@ -51,36 +91,60 @@ int search_tag(int key) {
  *
  */
 int open_tag(int key, uid_t perm) {
-    int i;
+    struct tag_t *tag;
+    int desc;
 
     spin_lock(&tag_lock);
 
-    for(i=0; i<MAX_TAGS; i++) {
-        // Key found
-        if(tags[i] != NULL && tags[i]->key == key){
+    desc = search_tag(key);
 
-            // Check if service it's private
-            if(tags[i]->private == 1){
-                printk("%s: Tag service with key %d it's private and cannot be opened\n", MODNAME, key);
-                spin_unlock(&tag_lock);
-                return -1;
-            }
+    // Key not found, private services can't be found by key
+    if(desc == -1){
+        printk(KERN_ERR "%s: Tag service with key %d doesn't exist or it's private\n", MODNAME, key);
+        spin_unlock(&tag_lock);
+        return -1;
+    }
 
-            // Check user permission
-            if(tags[i]->perm != -1 && tags[i]->perm != perm){
-                printk(KERN_ERR "%s: Tag service with key %d can't be opened by user %du\n", MODNAME, key, perm);
-                spin_unlock(&tag_lock);
-                return -1;
-            }
+    tag = rcu_dereference_protected(tags[DESC_INDEX(desc)], lockdep_is_held(&tag_lock));
 
-            spin_unlock(&tag_lock);
-            return i;
-        }
+    // Check user permission
+    if(tag->perm != -1 && tag->perm != perm){
+        printk(KERN_ERR "%s: Tag service with key %d can't be opened by user %du\n", MODNAME, key, perm);
+        spin_unlock(&tag_lock);
+        return -1;
     }
 
-    printk(KERN_ERR "%s: Tag service with key %d doesn't exist\n", MODNAME, key);
     spin_unlock(&tag_lock);
-    return -1;
+    return desc;
+}
+
+
+/* Called once the last user of a tag service being removed is gone
+ *
+ * ref = reference counter of the tag service
+ *
+ */
+static void release_tag(struct percpu_ref *ref){
+    struct tag_t *tag;
+
+    tag = container_of(ref, struct tag_t, ref);
+    complete(&tag->released);
+}
+
+/* Reclaims tag's space once a grace period has elapsed since it was unlinked
+ *
+ * head = rcu head of the tag service
+ *
+ */
+static void free_tag(struct rcu_head *head){
+    struct tag_t *tag;
+
+    tag = container_of(head, struct tag_t, rcu);
+
+    percpu_ref_exit(&tag->ref);
+    free_stats(tag->stats);
+    free_hist(tag->hist);
+    kmem_cache_free(tag_cache, tag);
 }
 
 
@@ -92,108 +156,123 @@ int open_tag(int key, uid_t perm) {
  *
  */
 int insert_tag(int key, int private, uid_t uid){
-    int i, desc;
+    int index;
     struct tag_t *new;
-    struct list_head *lv_head;
-
-    desc = -1;
 
-    spin_lock(&tag_lock);
-    for(i=0; i<MAX_TAGS; i++) {
-        // Check if key already exists
-        if (tags[i] != NULL && tags[i]->key == key) {
-            printk(KERN_ERR "%s: Tag service with key %d already exists\n", MODNAME, key);
-            spin_unlock(&tag_lock);
-            return -1;
-        }
+    new = (struct tag_t *)kmem_cache_zalloc(tag_cache, GFP_KERNEL); // Empty level table
 
-        // Free slot found
-        if (desc == -1 && tags[i] == NULL) desc = i;
+    // Check if new tag was correctly allocated
+    if(new == NULL){
+        printk(KERN_WARNING "%s: Unable to allocate new tag\n", MODNAME);
+        return -ENOMEM;
+    }
 
+    // Initialize reference counter, a per cpu counter so that users don't share a cacheline
+    if(percpu_ref_init(&new->ref, release_tag, 0, GFP_KERNEL) < 0){
+        printk(KERN_WARNING "%s: Unable to allocate new tag reference counter\n", MODNAME);
+        kmem_cache_free(tag_cache, new);
+        return -ENOMEM;
     }
 
-    if(desc != -1){
-        // Initializing list of levels
-        lv_head = (struct list_head *)kmalloc(sizeof(struct list_head), GFP_ATOMIC);
+    new->stats = alloc_stats();
+    new->hist = alloc_hist();
+    if(new->stats == NULL || new->hist == NULL){
+        percpu_ref_exit(&new->ref);
+        free_stats(new->stats);
+        free_hist(new->hist);
+        kmem_cache_free(tag_cache, new);
+        return -ENOMEM;
+    }
 
-        // Check if level list was correctly allocated
-        if(lv_head == NULL){
-            spin_unlock(&tag_lock);
-            printk(KERN_WARNING "%s: Unable to allocate new level list for tag service\n", MODNAME);
-            return -ENOMEM;
-        }
+    new->key = key;
+    new->private = private;
+    new->perm = uid;
+    new->removing = 0;
+    init_completion(&new->released);
+    spin_lock_init(&new->lv_lock);
 
-        INIT_LIST_HEAD(lv_head);
+    spin_lock(&tag_lock);
 
-        new = (struct tag_t *)kmalloc(sizeof(struct tag_t), GFP_ATOMIC);
+    // Check if key already exists
+    if(!private && search_tag(key) != -1){
+        printk(KERN_ERR "%s: Tag service with key %d already exists\n", MODNAME, key);
+        spin_unlock(&tag_lock);
+        percpu_ref_exit(&new->ref);
+        free_stats(new->stats);
+        free_hist(new->hist);
+        kmem_cache_free(tag_cache, new);
+        return -1;
+    }
 
-        // Check if new tag was correctly allocated
-        if(new == NULL){
-            spin_unlock(&tag_lock);
-            kfree(lv_head); // Release level list
-            printk(KERN_WARNING "%s: Unable to allocate new tag\n", MODNAME);
-            return -ENOMEM;
-        }
+    // Find free slot
+    index = find_first_zero_bit(used_desc, MAX_TAGS);
+    if(index >= MAX_TAGS){
+        printk(KERN_ERR "%s: Maximum number of tag services %d reached\n", MODNAME, MAX_TAGS);
+        spin_unlock(&tag_lock);
+        percpu_ref_exit(&new->ref);
+        free_stats(new->stats);
+        free_hist(new->hist);
+        kmem_cache_free(tag_cache, new);
+        return -1;
+    }
 
-        new->key = key;
-        new->private = private;
-        new->perm = uid;
-        new->used = 0;
-        new->removing = 0;
-        new->lv_head = lv_head;
+    new->desc = MAKE_DESC(index, tag_gen[index]);
 
-        tags[desc] = new;  // Add new tag
-    }
+    __set_bit(index, used_desc);
+    if(!private) hash_add_rcu(tag_index, &new->node, key);
+    rcu_assign_pointer(tags[index], new);  // Add new tag
 
     spin_unlock(&tag_lock);
-    return desc;
+
+    notify_change();
+    return new->desc;
 }
 
-/* Checks if tag service it's active and checks user permission
+/* Checks if tag service it's active and checks user permission, on success a reference to the service is taken
  *
- * tag = tag service to check
  * desc = tag descriptor
  * uid = user id for permission checking
  *
  */
-int check_tag(struct tag_t* tag, int desc, uid_t uid){
+struct tag_t *check_tag(int desc, uid_t uid){
+    struct tag_t *tag;
 
-    if(tag == NULL){
-        // Check if tag service it's active
+    if(desc < 0){
+        printk(KERN_ERR "%s: Invalid tag service descriptor %d\n", MODNAME, desc);
+        return NULL;
+    }
+
+    rcu_read_lock();
+
+    tag = rcu_dereference(tags[DESC_INDEX(desc)]);
+
+    if(tag == NULL || tag->desc != desc){
+        // Check if tag service it's active, stale descriptors of removed services are rejected
         printk(KERN_ERR "%s: Tag service %d to check doesn't exist\n", MODNAME, desc);
-        return -1;
+        tag = NULL;
     }
     else if(tag->perm != -1 && tag->perm != uid){
         // Check permission
         printk(KERN_ERR "%s: User %du doesn't have required permissions for tag service %d\n", MODNAME, uid, desc);
-        return -1;
+        tag = NULL;
     }
-    else if(tag->removing == 1){
+    else if(!percpu_ref_tryget_live(&tag->ref)){
         // Check if service it's being removed
-        printk("%s: Tag service %d to check it's being removed\n", MODNAME, uid);
-        return -1;
+        printk(KERN_ERR "%s: Tag service %d to check it's being removed\n", MODNAME, desc);
+        tag = NULL;
     }
 
-    tag->used++; // Signal that the service it's being used
-    return 0;
+    rcu_read_unlock();
+    return tag;
 }
 
 /* Signals that the tag service isn't being used anymore
  *
- * tag = tag service to check
- * desc = tag descriptor
+ * tag = tag service to uncheck
  *
  */
-int uncheck_tag(struct tag_t* tag, int desc){
-
-    if(tag == NULL){
-        // Check if tag service it's active
-        printk(KERN_ERR "%s: Tag service %d to uncheck doesn't exist\n", MODNAME, desc);
-        return -1;
-    }
-
-    tag->used--; // Signal that the task on the service has been completed
-    return 0;
+void uncheck_tag(struct tag_t* tag){
+    percpu_ref_put(&tag->ref); // Signal that the task on the service has been completed
 }
 
 /* Deletes a tag
@@ -203,43 +282,53 @@ int uncheck_tag(struct tag_t* tag, int desc){
  *
  */
 int delete_tag(int desc, uid_t uid){
-    int ret;
+    int index;
     struct tag_t *tag;
 
+    // Check tag service
+    tag = check_tag(desc, uid);
+    if(tag == NULL) return -1;
+
     spin_lock(&tag_lock);
 
-    // Check tag service
-    if(check_tag(tags[desc], desc, uid) < 0){
-        spin_unlock(&tag_lock);
-        return -1;
-    }
-    else if(tags[desc]->used > 1){
-        printk("%s: Tag service %d it's being used so it can't be removed\n", MODNAME, desc);
-        uncheck_tag(tags[desc], desc);
+    if(tag->removing == 1){
+        printk(KERN_ERR "%s: Tag service %d it's already being removed\n", MODNAME, desc);
         spin_unlock(&tag_lock);
+        uncheck_tag(tag);
         return -1;
     }
 
-    tags[desc]->removing = 1; // Signal that tag service will be removed
+    WRITE_ONCE(tag->removing, 1); // Signal that tag service will be removed
     spin_unlock(&tag_lock);
 
-    ret = cleanup_levels(tags[desc]->lv_head, tags[desc]->lv_lock);
+    percpu_ref_kill(&tag->ref); // New users are turned away
 
-    spin_lock(&tag_lock);
-    uncheck_tag(tags[desc], desc);
+    smp_mb(); // Pairs with enter_level, either waiting threads are seen here or they see the removal
 
     // Check if levels where removed
-    if(ret < 0) {
-        tags[desc]->removing = 0;
-        spin_unlock(&tag_lock);
+    if(cleanup_levels(tag) < 0) {
+        WRITE_ONCE(tag->removing, 0);
+        percpu_ref_resurrect(&tag->ref);
+        uncheck_tag(tag);
         return -1;
     }
 
-    tag = tags[desc];
-    tags[desc] = NULL;
+    index = DESC_INDEX(desc);
+
+    spin_lock(&tag_lock);
+    RCU_INIT_POINTER(tags[index], NULL);
+    if(!tag->private) hash_del_rcu(&tag->node);
+    tag_gen[index] = (tag_gen[index] + 1) & DESC_GEN_MASK; // Stale descriptors won't match the reused slot
+    __clear_bit(index, used_desc);
     spin_unlock(&tag_lock);
 
-    kfree(tag); // Reclaim space
+    notify_change();
+
+    uncheck_tag(tag);
+    wait_for_completion(&tag->released); // Wait for users which checked the service before it was killed
+
+    force_cleanup(tag); // Levels created by receivers racing with the removal
+    call_rcu(&tag->rcu, free_tag); // Reclaim space
     return 0;
 }
 
@@ -249,11 +338,12 @@ int delete_tag(int desc, uid_t uid){
  * level = level number
  * uid = user id for permission checking
  * message = where to store the message when sent
- * size = message's size
+ * small = where to copy the message if it's carried inline
  *
  */
-int wait_tag_message(int desc, int level, uid_t uid, char* message, size_t size){
+int wait_tag_message(int desc, int level, uid_t uid, struct message_t **message, struct small_message_t *small){
     int ret;
+    struct tag_t *tag;
 
     // Check level number
     if(level < 0 || level >= MAX_LV){
@@ -261,31 +351,146 @@ int wait_tag_message(int desc, int level, uid_t uid, char* message, size_t size)
         return -EINVAL;
     }
 
-    spin_lock(&tag_lock);
+    tag = check_tag(desc, uid);
+    if(tag == NULL) return -1;
 
-    ret = check_tag(tags[desc], desc, uid);
-    if(ret < 0) {
-        spin_unlock(&tag_lock);
-        return -1;
+    // If level doesn't already exist add new level
+    ret = insert_level(tag, level);
+
+    if(ret == 0){
+        trace_tag_wait_start(desc, 1UL << level);
+        ret = wait_for_message(tag, level, message, small); // Wait for message
     }
 
-    spin_unlock(&tag_lock);
+    uncheck_tag(tag);
+    return ret;
+}
+
+/* Add new process to the waiting list for a message from any of a set of levels
+ *
+ * desc = descriptor of the tag
+ * mask = bitmask of level numbers
+ * uid = user id for permission checking
+ * level = where to store the number of the level the message was delivered on
+ * message = where to store the message when sent
+ * small = where to copy the message if it's carried inline
+ *
+ */
+int wait_tag_mask(int desc, unsigned long mask, uid_t uid, int *level, struct message_t **message, struct small_message_t *small){
+    int ret;
+    unsigned long i;
+    struct tag_t *tag;
 
-    ret = search_level(tags[desc]->lv_head, level);
-    if(ret == -1){
-        // If level doesn't already exist add new level
-        ret = insert_level(tags[desc]->lv_head, tags[desc]->lv_lock, level);
+    tag = check_tag(desc, uid);
+    if(tag == NULL) return -1;
+
+    ret = 0;
+
+    // Add levels that don't already exist
+    for_each_set_bit(i, &mask, MAX_LV){
+        ret = insert_level(tag, i);
+        if(ret < 0) break;
     }
 
     if(ret == 0){
-        printk(KERN_DEBUG "%s: Process %d waiting for message...\n", MODNAME, current->pid);
-        ret = wait_for_message(tags[desc]->lv_head, level, message, size); // Wait for message
+        trace_tag_wait_start(desc, mask);
+        ret = wait_for_mask(tag, mask, level, message, small); // Wait for message
     }
 
-    spin_lock(&tag_lock);
-    uncheck_tag(tags[desc], desc);
-    spin_unlock(&tag_lock);
+    uncheck_tag(tag);
+    return ret;
+}
+
+/* Reads a message kept in the history of a level, or retained by it, newer than a generation
+ *
+ * desc = descriptor of the tag
+ * level = level number
+ * uid = user id for permission checking
+ * seq = generation already seen, updated with the generation of the message read
+ * nonblock = whether to fail instead of waiting if no newer message is kept
+ * message = where to store the message read
+ * small = where to copy the message if it's carried inline
+ *
+ */
+int read_tag_history(int desc, int level, uid_t uid, unsigned long *seq, int nonblock, struct message_t **message, struct small_message_t *small){
+    int ret;
+    struct tag_t *tag;
+
+    // Check level number
+    if(level < 0 || level >= MAX_LV){
+        printk(KERN_ERR "%s: Level number %d it's out of range [0,%d]\n", MODNAME, level, MAX_LV);
+        return -EINVAL;
+    }
+
+    tag = check_tag(desc, uid);
+    if(tag == NULL) return -1;
+
+    ret = insert_level(tag, level);
+
+    if(ret == 0){
+        trace_tag_wait_start(desc, 1UL << level);
+        ret = read_history(tag, level, seq, nonblock, message, small);
+    }
+
+    uncheck_tag(tag);
+    return ret;
+}
+
+/* Sets the number of messages kept in the history of a level
+ *
+ * desc = descriptor of the tag
+ * level = level number
+ * uid = user id for permission checking
+ * depth = number of messages to be kept, 0 disables the history
+ *
+ */
+int tag_level_history(int desc, int level, uid_t uid, unsigned int depth){
+    int ret;
+    struct tag_t *tag;
+
+    // Check level number
+    if(level < 0 || level >= MAX_LV){
+        printk(KERN_ERR "%s: Level number %d it's out of range [0,%d]\n", MODNAME, level, MAX_LV);
+        return -EINVAL;
+    }
+
+    tag = check_tag(desc, uid);
+    if(tag == NULL) return -1;
+
+    // If level doesn't already exist add new level
+    ret = insert_level(tag, level);
+    if(ret == 0) ret = set_history(tag, level, depth);
+
+    uncheck_tag(tag);
+    return ret;
+}
+
+/* Starts or stops retaining the last message published on a level
+ *
+ * desc = descriptor of the tag
+ * level = level number
+ * uid = user id for permission checking
+ * retain = 1 to retain the last message, 0 to stop retaining it
+ *
+ */
+int tag_level_retain(int desc, int level, uid_t uid, int retain){
+    int ret;
+    struct tag_t *tag;
+
+    // Check level number
+    if(level < 0 || level >= MAX_LV){
+        printk(KERN_ERR "%s: Level number %d it's out of range [0,%d]\n", MODNAME, level, MAX_LV);
+        return -EINVAL;
+    }
+
+    tag = check_tag(desc, uid);
+    if(tag == NULL) return -1;
 
+    // If level doesn't already exist add new level
+    ret = insert_level(tag, level);
+    if(ret == 0) ret = set_retain(tag, level, retain);
+
+    uncheck_tag(tag);
     return ret;
 }
 
@@ -297,91 +502,270 @@ int wait_tag_message(int desc, int level, uid_t uid, char* message, size_t size)
  * message = message to be sent
  *
 */
-int wakeup_tag_level(int desc, int level, uid_t uid, char *message){
+int wakeup_tag_level(int desc, int level, uid_t uid, struct message_t *message){
     int ret;
-
-    spin_lock(&tag_lock);
+    struct tag_t *tag;
 
     // Check tag service
-    ret = check_tag(tags[desc], desc, uid);
-    if(ret < 0) {
-        spin_unlock(&tag_lock);
-        return -1;
-    }
-
-    spin_unlock(&tag_lock);
+    tag = check_tag(desc, uid);
+    if(tag == NULL) return -1;
 
     if(level < 0){
         //Wake up all levels
-        ret = wakeup_all(tags[desc]->lv_head, tags[desc]->lv_lock);
+        ret = wakeup_all(tag);
     }
     else{
         //Send message to level
-        ret = wakeup_level(tags[desc]->lv_head, tags[desc]->lv_lock, level, message);
+        ret = wakeup_level(tag, level, message);
     }
 
-    spin_lock(&tag_lock);
-    uncheck_tag(tags[desc], desc);
-    spin_unlock(&tag_lock);
+    uncheck_tag(tag);
+    return ret;
+}
+
+/* Wakes up all threads waiting for the message from a set of levels from that tag service
+ *
+ * desc = descriptor of the tag
+ * mask = bitmask of level numbers
+ * uid = user id for permission check
+ * message = message to be sent
+ *
+ * Returns the number of levels the message was delivered to.
+ *
+*/
+int wakeup_tag_mask(int desc, unsigned long mask, uid_t uid, struct message_t *message){
+    int ret;
+    struct tag_t *tag;
+
+    // Check tag service once for all levels
+    tag = check_tag(desc, uid);
+    if(tag == NULL) return -1;
+
+    ret = wakeup_mask(tag, mask, message);
+
+    uncheck_tag(tag);
+    return ret;
+}
+
+/* Checks whether any thread is waiting for a message from that level from that tag service
+ *
+ * desc = descriptor of the tag
+ * level = level number
+ * uid = user id for permission check
+ *
+ * Returns 1 if threads are waiting, 0 if none is and -1 if the tag service can't be used. If none is waiting the caller
+ * is expected to drop the message, which is accounted as sent and discarded.
+ *
+*/
+int tag_level_waiting(int desc, int level, uid_t uid){
+    int ret;
+    struct tag_t *tag;
+
+    // Check tag service
+    tag = check_tag(desc, uid);
+    if(tag == NULL) return -1;
+
+    ret = search_level(tag, level) == 0;
+
+    if(ret == 0) discard_message(tag, level);
 
+    uncheck_tag(tag);
     return ret;
 }
 
 /* Removes all tags currently active */
 void cleanup_tags(void){
     int i;
+    struct tag_t *tag;
 
     spin_lock(&tag_lock);
 
     for(i=0; i<MAX_TAGS; i++){
 
-        if(tags[i] != NULL){
+        tag = rcu_dereference_protected(tags[i], lockdep_is_held(&tag_lock));
 
-            tags[i]->removing = 1;
-            spin_unlock(&tag_lock);
+        if(tag != NULL){
 
-            force_cleanup(tags[i]->lv_head, tags[i]->lv_lock);  // Cleanup all levels
+            tag->removing = 1;
+            RCU_INIT_POINTER(tags[i], NULL);
+            if(!tag->private) hash_del_rcu(&tag->node);
+            __clear_bit(i, used_desc);
 
-            spin_lock(&tag_lock);
-            kfree(tags[i]); // Reclaim space
-            tags[i] = NULL;
+            percpu_ref_kill(&tag->ref);
+            force_cleanup(tag);  // Cleanup all levels
+            call_rcu(&tag->rcu, free_tag); // Reclaim space
 
-            printk("%s: Tag service %d removed\n", MODNAME, i);
+            printk("%s: Tag service %d removed\n", MODNAME, tag->desc);
         }
 
     }
 
     spin_unlock(&tag_lock);
+
+    rcu_barrier(); // Wait for tags and levels still pending reclamation
+
     printk("%s: All tag services have been removed\n", MODNAME);
 }
 
-/* Writes info about the tag services currently active in a buffer
+/* Reads the latency histograms of a tag service
  *
- * buffer = where to write the info
+ * desc = descriptor of the tag
+ * uid = user id for permission check
+ * sum = where to store the histograms summed up over every cpu
  *
-*/
-int tag_info(char* buffer){
+ */
+int tag_hist(int desc, uid_t uid, struct tag_hist_t *sum){
+    struct tag_t *tag;
+
+    tag = check_tag(desc, uid);
+    if(tag == NULL) return -1;
+
+    read_hist(tag->hist, sum);
+
+    uncheck_tag(tag);
+    return 0;
+}
+
+/* Resets the latency histograms of a tag service
+ *
+ * desc = descriptor of the tag
+ * uid = user id for permission check
+ *
+ */
+int tag_hist_reset(int desc, uid_t uid){
+    struct tag_t *tag;
+
+    tag = check_tag(desc, uid);
+    if(tag == NULL) return -1;
+
+    reset_hist(tag->hist);
+
+    uncheck_tag(tag);
+    return 0;
+}
+
+/* Fills a record with the info about a tag service or one of its levels
+ *
+ * info = record to be filled
+ * tag = tag service
+ * level = level number, -1 for the totals of the tag service
+ * threads = number of waiting threads
+ * stats = counters to be copied
+ *
+ */
+static void fill_info(struct tag_record *info, struct tag_t *tag, int level, int threads, struct tag_stats_t __percpu *stats){
+    struct tag_stats_t sum;
+
+    BUILD_BUG_ON(TAG_COUNTERS != STATS);
+
+    read_stats(stats, &sum);
+
+    info->key = tag->key;
+    info->creator = tag->perm;
+    info->level = level;
+    info->waiters = threads;
+    memcpy(info->count, sum.count, sizeof(info->count));
+}
+
+/* Adds the records of a tag service, the one with its totals is followed by one for each of its levels, must be called
+ * in an RCU read side critical section
+ *
+ * tag = tag service
+ * info = where to store the records
+ * n = number of records already stored
+ * max = maximum number of records to be stored
+ *
+ * Returns the number of records including the new ones, which may be more than max.
+ *
+ */
+static int tag_records(struct tag_t *tag, struct tag_record *info, int n, int max){
     struct level_t *p;
-    int i, off;
+    int j, start, threads;
+
+    // Its record is filled once the levels have been counted
+    start = n++;
+    threads = 0;
+
+    for(j=0; j<MAX_LV; j++){
+        p = rcu_dereference(tag->levels[j]);
+        if(p == NULL) continue;
+
+        // Add level info
+        if(n < max) fill_info(&info[n], tag, p->num, p->threads, p->stats);
+        n++;
+
+        threads += p->threads;
+    }
+
+    // Add tag service totals
+    if(start < max) fill_info(&info[start], tag, -1, threads, tag->stats);
+
+    return n;
+}
 
-    snprintf(buffer, sizeof(char)*100, "%s\n", " TAG-key   TAG-creator   TAG-level   Waiting-threads "); // Add header
+/* Takes a snapshot of the tag services currently active, a record with the totals of each tag service is followed by
+ * a record for each of its levels
+ *
+ * info = where to store the records, NULL to only count them
+ * max = maximum number of records to be stored
+ *
+ * Returns the number of records of the snapshot, which may be more than max if the array was too small.
+ *
+*/
+int tag_info(struct tag_record *info, int max){
+    struct tag_t *tag;
+    int i, n;
+
+    n = 0;
 
-    off = 100;
+    rcu_read_lock();
 
     for(i=0; i<MAX_TAGS; i++) {
-        if(tags[i] != NULL){
-            // Active tag service found
-
-            rcu_read_lock();
-            list_for_each_entry(p, tags[i]->lv_head, list){
-                // Add level info
-                snprintf(buffer + off, sizeof(char)*100, " %7d   %11d   %9d   %15d \n", tags[i]->key, tags[i]->perm, p->num, p->threads);
-                off += 100;
-            }
-            rcu_read_unlock();
+        tag = rcu_dereference(tags[i]);
 
+        // Active tag service found
+        if(tag != NULL) n = tag_records(tag, info, n, max);
+    }
+
+    rcu_read_unlock();
+
+    return n;
+}
+
+/* Takes a snapshot of a single tag service, selected either by descriptor or by key, without scanning the others
+ *
+ * desc = descriptor of the tag, -1 to select it by key
+ * key = key of the tag, private services can't be selected by key
+ * info = where to store the records, at least MAX_LV + 1
+ *
+ * Returns the number of records of the snapshot, -1 if the tag service doesn't exist.
+ *
+*/
+int tag_query(int desc, int key, struct tag_record *info){
+    struct tag_t *tag, *p;
+    int n;
+
+    rcu_read_lock();
+
+    tag = NULL;
+
+    if(desc >= 0){
+        // Stale descriptors of removed services are rejected
+        tag = rcu_dereference(tags[DESC_INDEX(desc)]);
+        if(tag != NULL && tag->desc != desc) tag = NULL;
+    }
+    else{
+        hash_for_each_possible_rcu(tag_index, p, node, key){
+            if(p->key == key){
+                tag = p;
+                break;
+            }
         }
     }
 
-    return off;
-}
\ No newline at end of file
+    n = tag != NULL ? tag_records(tag, info, 0, MAX_LV + 1) : -1;
+
+    rcu_read_unlock();
+
+    return n;
+}
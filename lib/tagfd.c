@@ -0,0 +1,152 @@
+/* ---------------------------------------------------------------------------------------------------------------------
+ TAG FD
+
+ This module implements file descriptors bound to a level of a tag service ( see /include/struct.h for struct
+ tag_file_t), so that messages can be waited for with poll, select or epoll and read without blocking.
+--------------------------------------------------------------------------------------------------------------------- */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/anon_inodes.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/uaccess.h>
+#include <linux/string.h>
+#include "../include/tagfd.h"
+#include "../include/tag.h"
+#include "../include/level.h"
+#include "../include/message.h"
+#include "../include/stats.h"
+#include "../include/struct.h"
+#include "../config.h"
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Lisa Trombetti <lisa.trombetti96@gmail.com>");
+MODULE_DESCRIPTION("TAG FD");
+
+#define MODNAME "TAG FD"
+
+
+/* Reads the last message delivered on the level since the previous read, blocks unless the file is non blocking and
+ * fails with -ECANCELED if the last generation was published by AWAKE_ALL
+ */
+static ssize_t tag_fd_read(struct file *file, char __user *buf, size_t count, loff_t *off){
+    struct tag_file_t *ctx = file->private_data;
+    struct small_message_t small;
+    struct message_t *message;
+    size_t len;
+    int ret;
+
+    while((ret = take_message(ctx->tag, ctx->level, &ctx->seq, &message, &small)) == 0){
+        if(file->f_flags & O_NONBLOCK) return -EAGAIN;
+
+        // Wait for a new generation
+        if(wait_event_interruptible(ctx->level->wq, READ_ONCE(ctx->level->seq) != READ_ONCE(ctx->seq))){
+            add_stat(ctx->tag, ctx->level, STAT_SIGNALS, 1);
+            return -ERESTARTSYS;
+        }
+    }
+
+    if(ret < 0) return ret;
+
+    len = min(count, message->size);
+
+    if(copy_to_user(buf, message->buffer, len)){
+        printk(KERN_ERR "%s: Error copying message to user space\n", MODNAME);
+        put_message(message);
+        return -EFAULT;
+    }
+
+    put_message(message);
+    return len;
+}
+
+/* Readable once a message newer than the last one read is delivered on the level */
+static __poll_t tag_fd_poll(struct file *file, poll_table *wait){
+    struct tag_file_t *ctx = file->private_data;
+
+    poll_wait(file, &ctx->level->wq, wait); // Woken up by senders together with blocked receivers
+
+    return READ_ONCE(ctx->level->seq) != READ_ONCE(ctx->seq) ? EPOLLIN | EPOLLRDNORM : 0;
+}
+
+/* Stops listening on the level once the last reference to the file is gone */
+static int tag_fd_release(struct inode *inode, struct file *file){
+    struct tag_file_t *ctx = file->private_data;
+
+    unlisten_level(ctx->tag, ctx->level);
+    uncheck_tag(ctx->tag);
+    kfree(ctx);
+
+    return 0;
+}
+
+static const struct file_operations tag_fops = {
+    .owner = THIS_MODULE,
+    .read = tag_fd_read,
+    .poll = tag_fd_poll,
+    .release = tag_fd_release
+};
+
+/* Creates a new file descriptor bound to a level of a tag service
+ *
+ * desc = descriptor of the tag
+ * level = level number
+ * uid = user id for permission check
+ * flags = O_NONBLOCK and O_CLOEXEC are accepted
+ *
+ */
+int create_tag_fd(int desc, int level, uid_t uid, int flags){
+    struct tag_file_t *ctx;
+    struct tag_t *tag;
+    int fd;
+
+    // Check level number
+    if(level < 0 || level >= MAX_LV){
+        printk(KERN_ERR "%s: Level number %d it's out of range [0,%d]\n", MODNAME, level, MAX_LV);
+        return -EINVAL;
+    }
+
+    if(flags & ~(O_NONBLOCK | O_CLOEXEC)){
+        printk(KERN_ERR "%s: Invalid flags %#x\n", MODNAME, flags);
+        return -EINVAL;
+    }
+
+    ctx = (struct tag_file_t *)kmalloc(sizeof(struct tag_file_t), GFP_KERNEL);
+    if(ctx == NULL){
+        printk(KERN_ERR "%s: Unable to allocate new file\n", MODNAME);
+        return -ENOMEM;
+    }
+
+    // The tag service stays checked until the file is released
+    tag = check_tag(desc, uid);
+    if(tag == NULL){
+        kfree(ctx);
+        return -1;
+    }
+
+    if(insert_level(tag, level) < 0) goto fail;
+
+    ctx->tag = tag;
+    ctx->desc = desc;
+
+    // Listening counts as waiting, messages are kept for the file and the tag service can't be removed
+    ctx->level = listen_level(tag, level, &ctx->seq);
+    if(ctx->level == NULL) goto fail;
+
+    fd = anon_inode_getfd("[tag]", &tag_fops, ctx, O_RDONLY | flags);
+    if(fd < 0){
+        unlisten_level(tag, ctx->level);
+        goto fail;
+    }
+
+    return fd;
+
+fail:
+    uncheck_tag(tag);
+    kfree(ctx);
+    return -1;
+}
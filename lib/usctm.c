@@ -1,11 +1,20 @@
 /* ---------------------------------------------------------------------------------------------------------------------
  USCTM
 
- This module implements a system call table discoverer which is used to insert 4 new system calls:
+ This module implements a system call table discoverer which is used to insert new system calls:
     - tag_get
     - tag_send
     - tag_receive
     - tag_ctl
+    - tag_send_multi
+    - tag_send_mask
+    - tag_receive_mask
+    - tag_waitset
+    - tag_waitset_wait
+    - tag_fd
+    - tag_level_ctl
+    - tag_receive_seq
+    - tag_subscribe
 
  The code for the hacking of the system call table was taken from this repository :
  https://github.com/FrancescoQuaglia/Linux-sys_call_table-discoverer
@@ -58,6 +67,12 @@ extern int sys_vtpmo(unsigned long vaddr);
 #define FIFTH_NI_SYSCALL	214
 #define SIXTH_NI_SYSCALL	215
 #define SEVENTH_NI_SYSCALL	236
+#define EIGHTH_NI_SYSCALL	177
+#define NINTH_NI_SYSCALL	178
+#define TENTH_NI_SYSCALL	180
+#define ELEVENTH_NI_SYSCALL	181
+#define TWELFTH_NI_SYSCALL	184
+#define THIRTEENTH_NI_SYSCALL	185
 
 #define ENTRIES_TO_EXPLORE 256
 
@@ -115,6 +130,12 @@ int validate_page(unsigned long *addr){
                 &&   ( addr[FIRST_NI_SYSCALL] == addr[FIFTH_NI_SYSCALL] )
                 &&   ( addr[FIRST_NI_SYSCALL] == addr[SIXTH_NI_SYSCALL] )
                 &&   ( addr[FIRST_NI_SYSCALL] == addr[SEVENTH_NI_SYSCALL] )
+                &&   ( addr[FIRST_NI_SYSCALL] == addr[EIGHTH_NI_SYSCALL] )
+                &&   ( addr[FIRST_NI_SYSCALL] == addr[NINTH_NI_SYSCALL] )
+                &&   ( addr[FIRST_NI_SYSCALL] == addr[TENTH_NI_SYSCALL] )
+                &&   ( addr[FIRST_NI_SYSCALL] == addr[ELEVENTH_NI_SYSCALL] )
+                &&   ( addr[FIRST_NI_SYSCALL] == addr[TWELFTH_NI_SYSCALL] )
+                &&   ( addr[FIRST_NI_SYSCALL] == addr[THIRTEENTH_NI_SYSCALL] )
                 &&   (good_area(addr))
                 ){
             hacked_ni_syscall = (void*)(addr[FIRST_NI_SYSCALL]);				// save ni_syscall
@@ -214,11 +235,92 @@ asmlinkage int sys_tag_ctl(int tag, int command) {
     return tag_ctl(tag, command);
 }
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,17,0)
+__SYSCALL_DEFINEx(4, _tag_send_multi, struct tag_dest_t *, dests, int, count, char *, buffer, size_t, size) {
+#else
+asmlinkage int sys_tag_send_multi(struct tag_dest_t *dests, int count, char *buffer, size_t size) {
+#endif
+    return tag_send_multi(dests, count, buffer, size);
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,17,0)
+__SYSCALL_DEFINEx(4, _tag_send_mask, int, tag, unsigned long, mask, char *, buffer, size_t, size) {
+#else
+asmlinkage int sys_tag_send_mask(int tag, unsigned long mask, char *buffer, size_t size) {
+#endif
+    return tag_send_mask(tag, mask, buffer, size);
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,17,0)
+__SYSCALL_DEFINEx(5, _tag_receive_mask, int, tag, unsigned long, mask, char *, buffer, size_t, size, int *, level) {
+#else
+asmlinkage int sys_tag_receive_mask(int tag, unsigned long mask, char *buffer, size_t size, int *level) {
+#endif
+    return tag_receive_mask(tag, mask, buffer, size, level);
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,17,0)
+__SYSCALL_DEFINEx(4, _tag_waitset, int, ws, int, command, int, tag, int, level) {
+#else
+asmlinkage int sys_tag_waitset(int ws, int command, int tag, int level) {
+#endif
+    return tag_waitset(ws, command, tag, level);
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,17,0)
+__SYSCALL_DEFINEx(4, _tag_waitset_wait, int, ws, struct tag_event_t *, event, char *, buffer, size_t, size) {
+#else
+asmlinkage int sys_tag_waitset_wait(int ws, struct tag_event_t *event, char *buffer, size_t size) {
+#endif
+    return tag_waitset_wait(ws, event, buffer, size);
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,17,0)
+__SYSCALL_DEFINEx(3, _tag_fd, int, tag, int, level, int, flags) {
+#else
+asmlinkage int sys_tag_fd(int tag, int level, int flags) {
+#endif
+    return tag_fd(tag, level, flags);
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,17,0)
+__SYSCALL_DEFINEx(4, _tag_level_ctl, int, tag, int, level, int, command, int, arg) {
+#else
+asmlinkage int sys_tag_level_ctl(int tag, int level, int command, int arg) {
+#endif
+    return tag_level_ctl(tag, level, command, arg);
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,17,0)
+__SYSCALL_DEFINEx(6, _tag_receive_seq, int, tag, int, level, char *, buffer, size_t, size, unsigned long *, seq, int, flags) {
+#else
+asmlinkage int sys_tag_receive_seq(int tag, int level, char *buffer, size_t size, unsigned long *seq, int flags) {
+#endif
+    return tag_receive_seq(tag, level, buffer, size, seq, flags);
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,17,0)
+__SYSCALL_DEFINEx(5, _tag_subscribe, int, tag, int, level, int, depth, int, policy, int, flags) {
+#else
+asmlinkage int sys_tag_subscribe(int tag, int level, int depth, int policy, int flags) {
+#endif
+    return tag_subscribe(tag, level, depth, policy, flags);
+}
+
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4,17,0)
 static unsigned long sys_tag_get = (unsigned long) __x64_sys_tag_get;
 static unsigned long sys_tag_send = (unsigned long) __x64_sys_tag_send;
 static unsigned long sys_tag_receive = (unsigned long) __x64_sys_tag_receive;
 static unsigned long sys_tag_ctl = (unsigned long) __x64_sys_tag_ctl;
+static unsigned long sys_tag_send_multi = (unsigned long) __x64_sys_tag_send_multi;
+static unsigned long sys_tag_send_mask = (unsigned long) __x64_sys_tag_send_mask;
+static unsigned long sys_tag_receive_mask = (unsigned long) __x64_sys_tag_receive_mask;
+static unsigned long sys_tag_waitset = (unsigned long) __x64_sys_tag_waitset;
+static unsigned long sys_tag_waitset_wait = (unsigned long) __x64_sys_tag_waitset_wait;
+static unsigned long sys_tag_fd = (unsigned long) __x64_sys_tag_fd;
+static unsigned long sys_tag_level_ctl = (unsigned long) __x64_sys_tag_level_ctl;
+static unsigned long sys_tag_receive_seq = (unsigned long) __x64_sys_tag_receive_seq;
+static unsigned long sys_tag_subscribe = (unsigned long) __x64_sys_tag_subscribe;
 #else
 #endif
 
@@ -245,6 +347,17 @@ int init_module(void) {
             if(j>=MAX_FREE) break;
         }
 
+    if(init_service() < 0) {
+        printk("%s: Error initializing service\n", MODNAME);
+        return -1;
+    }
+
+    if(init_device() < 0) {
+        printk("%s: Error initializing new device driver\n", MODNAME);
+        goto fail_device;
+    }
+
+    // System calls are installed last, nothing can reach the service before it's completely initialized
 #ifdef SYS_CALL_INSTALL
     cr0 = read_cr0();
     unprotect_memory();
@@ -252,39 +365,67 @@ int init_module(void) {
     hacked_syscall_tbl[SECOND_NI_SYSCALL] = (unsigned long*)sys_tag_send;
     hacked_syscall_tbl[THIRD_NI_SYSCALL] = (unsigned long*)sys_tag_receive;
     hacked_syscall_tbl[FOURTH_NI_SYSCALL] = (unsigned long*)sys_tag_ctl;
+    hacked_syscall_tbl[FIFTH_NI_SYSCALL] = (unsigned long*)sys_tag_send_multi;
+    hacked_syscall_tbl[SIXTH_NI_SYSCALL] = (unsigned long*)sys_tag_send_mask;
+    hacked_syscall_tbl[SEVENTH_NI_SYSCALL] = (unsigned long*)sys_tag_receive_mask;
+    hacked_syscall_tbl[EIGHTH_NI_SYSCALL] = (unsigned long*)sys_tag_waitset;
+    hacked_syscall_tbl[NINTH_NI_SYSCALL] = (unsigned long*)sys_tag_waitset_wait;
+    hacked_syscall_tbl[TENTH_NI_SYSCALL] = (unsigned long*)sys_tag_fd;
+    hacked_syscall_tbl[ELEVENTH_NI_SYSCALL] = (unsigned long*)sys_tag_level_ctl;
+    hacked_syscall_tbl[TWELFTH_NI_SYSCALL] = (unsigned long*)sys_tag_receive_seq;
+    hacked_syscall_tbl[THIRTEENTH_NI_SYSCALL] = (unsigned long*)sys_tag_subscribe;
     protect_memory();
     printk("%s: sys_tag_get installed on the sys_call_table at displacement %d\n",MODNAME,FIRST_NI_SYSCALL);
     printk("%s: sys_tag_send installed on the sys_call_table at displacement %d\n",MODNAME,SECOND_NI_SYSCALL);
     printk("%s: sys_tag_receive installed on the sys_call_table at displacement %d\n",MODNAME,THIRD_NI_SYSCALL);
     printk("%s: sys_tag_ctl installed on the sys_call_table at displacement %d\n",MODNAME,FOURTH_NI_SYSCALL);
+    printk("%s: sys_tag_send_multi installed on the sys_call_table at displacement %d\n",MODNAME,FIFTH_NI_SYSCALL);
+    printk("%s: sys_tag_send_mask installed on the sys_call_table at displacement %d\n",MODNAME,SIXTH_NI_SYSCALL);
+    printk("%s: sys_tag_receive_mask installed on the sys_call_table at displacement %d\n",MODNAME,SEVENTH_NI_SYSCALL);
+    printk("%s: sys_tag_waitset installed on the sys_call_table at displacement %d\n",MODNAME,EIGHTH_NI_SYSCALL);
+    printk("%s: sys_tag_waitset_wait installed on the sys_call_table at displacement %d\n",MODNAME,NINTH_NI_SYSCALL);
+    printk("%s: sys_tag_fd installed on the sys_call_table at displacement %d\n",MODNAME,TENTH_NI_SYSCALL);
+    printk("%s: sys_tag_level_ctl installed on the sys_call_table at displacement %d\n",MODNAME,ELEVENTH_NI_SYSCALL);
+    printk("%s: sys_tag_receive_seq installed on the sys_call_table at displacement %d\n",MODNAME,TWELFTH_NI_SYSCALL);
+    printk("%s: sys_tag_subscribe installed on the sys_call_table at displacement %d\n",MODNAME,THIRTEENTH_NI_SYSCALL);
 #else
 #endif
 
-    if(init_device() < 0) {
-        printk("%s: Error initializing new device driver\n", MODNAME);
-        return -1;
-    }
-
     printk("%s: Module correctly mounted\n",MODNAME);
     return 0;
+
+fail_device:
+    cleanup_service();
+    return -1;
 }
 
 void cleanup_module(void) {
 
-    cleanup_service(); // Remove service
-
-    cleanup_device(); // Remove device driver
-
 #ifdef SYS_CALL_INSTALL
+    // System calls are removed first, so that no new call can reach the service while it's being torn down
     cr0 = read_cr0();
     unprotect_memory();
     hacked_syscall_tbl[FIRST_NI_SYSCALL] = (unsigned long*)hacked_ni_syscall;
     hacked_syscall_tbl[SECOND_NI_SYSCALL] = (unsigned long*)hacked_ni_syscall;
     hacked_syscall_tbl[THIRD_NI_SYSCALL] = (unsigned long*)hacked_ni_syscall;
     hacked_syscall_tbl[FOURTH_NI_SYSCALL] = (unsigned long*)hacked_ni_syscall;
+    hacked_syscall_tbl[FIFTH_NI_SYSCALL] = (unsigned long*)hacked_ni_syscall;
+    hacked_syscall_tbl[SIXTH_NI_SYSCALL] = (unsigned long*)hacked_ni_syscall;
+    hacked_syscall_tbl[SEVENTH_NI_SYSCALL] = (unsigned long*)hacked_ni_syscall;
+    hacked_syscall_tbl[EIGHTH_NI_SYSCALL] = (unsigned long*)hacked_ni_syscall;
+    hacked_syscall_tbl[NINTH_NI_SYSCALL] = (unsigned long*)hacked_ni_syscall;
+    hacked_syscall_tbl[TENTH_NI_SYSCALL] = (unsigned long*)hacked_ni_syscall;
+    hacked_syscall_tbl[ELEVENTH_NI_SYSCALL] = (unsigned long*)hacked_ni_syscall;
+    hacked_syscall_tbl[TWELFTH_NI_SYSCALL] = (unsigned long*)hacked_ni_syscall;
+    hacked_syscall_tbl[THIRTEENTH_NI_SYSCALL] = (unsigned long*)hacked_ni_syscall;
     protect_memory();
 #else
 #endif
+
+    cleanup_device(); // Remove device driver
+
+    cleanup_service(); // Remove service
+
     printk("%s: Shutting down\n",MODNAME);
 
 }
\ No newline at end of file
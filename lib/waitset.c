@@ -0,0 +1,277 @@
+/* ---------------------------------------------------------------------------------------------------------------------
+ WAIT SET
+
+ This module implements wait sets ( see /include/struct.h for struct waitset_t), lists of pairs of tag service
+ descriptor and level, possibly belonging to different tag services, on which a single thread can wait at once. Each
+ wait set is bound to a file descriptor, so that it's destroyed once closed or when the process exits.
+--------------------------------------------------------------------------------------------------------------------- */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/string.h>
+#include <linux/sched.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/anon_inodes.h>
+#include "../include/waitset.h"
+#include "../include/tag.h"
+#include "../include/level.h"
+#include "../include/struct.h"
+#include "../config.h"
+#include "../include/tag_trace.h"
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Lisa Trombetti <lisa.trombetti96@gmail.com>");
+MODULE_DESCRIPTION("WAIT SET");
+
+#define MODNAME "WAIT SET"
+
+
+static const struct file_operations ws_fops;
+
+
+/* Gets the wait set bound to a file descriptor, the reference taken to the file must be released with fdput
+ *
+ * ws = wait set descriptor
+ * f = where to store the reference to the file
+ *
+ */
+static struct waitset_t *get_waitset(int ws, struct fd *f){
+
+    *f = fdget(ws);
+
+    if(f->file == NULL || f->file->f_op != &ws_fops){
+        printk(KERN_ERR "%s: Descriptor %d isn't a wait set\n", MODNAME, ws);
+        fdput(*f);
+        return NULL;
+    }
+
+    return (struct waitset_t *)f->file->private_data;
+}
+
+/* Destroys the wait set once the last reference to its file is gone, threads waiting on it hold one */
+static int ws_release(struct inode *inode, struct file *file){
+    struct waitset_t *set = file->private_data;
+
+    mutex_destroy(&set->lock);
+    kvfree(set);
+
+    return 0;
+}
+
+static const struct file_operations ws_fops = {
+    .owner = THIS_MODULE,
+    .release = ws_release
+};
+
+/* Creates a new empty wait set, bound to a new close on exec file descriptor */
+int create_waitset(void){
+    struct waitset_t *new;
+    int fd;
+
+    new = (struct waitset_t *)kvmalloc(sizeof(struct waitset_t), GFP_KERNEL); // Wait entries make it span several pages
+    if(new == NULL){
+        printk(KERN_ERR "%s: Unable to allocate new wait set\n", MODNAME);
+        return -ENOMEM;
+    }
+
+    mutex_init(&new->lock);
+    new->count = 0;
+    new->waiting = 0;
+
+    fd = anon_inode_getfd("[tag_waitset]", &ws_fops, new, O_RDWR | O_CLOEXEC);
+    if(fd < 0){
+        mutex_destroy(&new->lock);
+        kvfree(new);
+        printk(KERN_ERR "%s: Unable to create wait set file descriptor\n", MODNAME);
+        return fd;
+    }
+
+    return fd;
+}
+
+/* Adds a pair of tag service and level to a wait set
+ *
+ * ws = wait set descriptor
+ * uid = user id for permission check
+ * tag = tag service descriptor
+ * level = level number
+ *
+ */
+int add_waitset(int ws, uid_t uid, int tag, int level){
+    struct waitset_t *set;
+    struct tag_t *p;
+    struct fd f;
+    int i, ret;
+
+    // Check level number
+    if(level < 0 || level >= MAX_LV){
+        printk(KERN_ERR "%s: Level number %d it's out of range [0,%d]\n", MODNAME, level, MAX_LV);
+        return -EINVAL;
+    }
+
+    // Check that the tag service can be used by the caller
+    p = check_tag(tag, uid);
+    if(p == NULL) return -1;
+    uncheck_tag(p);
+
+    set = get_waitset(ws, &f);
+    if(set == NULL) return -1;
+
+    ret = 0;
+
+    mutex_lock(&set->lock);
+
+    for(i=0; i<set->count; i++){
+        if(set->entries[i].tag == tag && set->entries[i].level == level){
+            printk(KERN_ERR "%s: Tag service %d level %d already in wait set %d\n", MODNAME, tag, level, ws);
+            ret = -1;
+            break;
+        }
+    }
+
+    if(ret == 0 && set->count == WS_ENTRIES){
+        printk(KERN_ERR "%s: Wait set %d is full\n", MODNAME, ws);
+        ret = -1;
+    }
+
+    if(ret == 0){
+        set->entries[set->count].tag = tag;
+        set->entries[set->count].level = level;
+        set->count++;
+    }
+
+    mutex_unlock(&set->lock);
+
+    fdput(f);
+    return ret;
+}
+
+/* Removes a pair of tag service and level from a wait set
+ *
+ * ws = wait set descriptor
+ * tag = tag service descriptor
+ * level = level number
+ *
+ */
+int remove_waitset(int ws, int tag, int level){
+    struct waitset_t *set;
+    struct fd f;
+    int i, ret;
+
+    set = get_waitset(ws, &f);
+    if(set == NULL) return -1;
+
+    ret = -1;
+
+    mutex_lock(&set->lock);
+
+    for(i=0; i<set->count; i++){
+        if(set->entries[i].tag == tag && set->entries[i].level == level){
+            set->entries[i] = set->entries[--set->count]; // Order of entries doesn't matter
+            ret = 0;
+            break;
+        }
+    }
+
+    mutex_unlock(&set->lock);
+
+    if(ret < 0) printk(KERN_ERR "%s: Tag service %d level %d not in wait set %d\n", MODNAME, tag, level, ws);
+
+    fdput(f);
+    return ret;
+}
+
+/* Waits for a message from any of the pairs of tag service and level of a wait set
+ *
+ * ws = wait set descriptor
+ * uid = user id for permission check
+ * event = where to store the pair of tag service and level the message was delivered on
+ * message = where to store the message when sent
+ * small = where to copy the message if it's carried inline
+ *
+ */
+int waitset_wait(int ws, uid_t uid, struct tag_event_t *event, struct message_t **message, struct small_message_t *small){
+    struct waitset_t *set;
+    struct level_wait_t *w;
+    struct tag_t *tag;
+    struct fd f;
+    int i, n, ret;
+
+    set = get_waitset(ws, &f);
+    if(set == NULL) return -1;
+
+    mutex_lock(&set->lock);
+
+    if(set->count == 0){
+        mutex_unlock(&set->lock);
+        fdput(f);
+        printk(KERN_ERR "%s: Wait set %d is empty\n", MODNAME, ws);
+        return -1;
+    }
+
+    // The wait entries kept in the wait set are used unless another thread is already waiting on it
+    w = set->wait;
+    if(set->waiting){
+        w = (struct level_wait_t *)kvmalloc_array(set->count, sizeof(struct level_wait_t), GFP_KERNEL);
+        if(w == NULL){
+            mutex_unlock(&set->lock);
+            fdput(f);
+            printk(KERN_ERR "%s: Unable to allocate wait entries\n", MODNAME);
+            return -ENOMEM;
+        }
+    }
+    else{
+        set->waiting = 1;
+    }
+
+    n = 0;
+    ret = 0;
+
+    // Enter every level, the tag services stay checked while this thread is waiting and the wait set can change
+    for(i=0; i<set->count; i++){
+        tag = check_tag(set->entries[i].tag, uid);
+        if(tag == NULL){
+            ret = -1;
+            break;
+        }
+
+        if(insert_level(tag, set->entries[i].level) < 0 || enter_wait(&w[n], tag, set->entries[i].level) < 0){
+            uncheck_tag(tag);
+            ret = -1;
+            break;
+        }
+
+        trace_tag_wait_start(set->entries[i].tag, 1UL << set->entries[i].level);
+        n++;
+    }
+
+    mutex_unlock(&set->lock);
+
+    if(ret == 0) ret = wait_any(w, n); // Index of the entry the message was delivered on
+
+    if(ret >= 0){
+        event->tag = w[ret].tag->desc;
+        event->level = w[ret].num;
+    }
+
+    for(i=0; i<n; i++){
+        leave_wait(&w[i], i == ret ? message : NULL, small);
+        uncheck_tag(w[i].tag);
+    }
+
+    if(w == set->wait){
+        mutex_lock(&set->lock);
+        set->waiting = 0;
+        mutex_unlock(&set->lock);
+    }
+    else{
+        kvfree(w);
+    }
+
+    fdput(f);
+    return ret < 0 ? ret : 0;
+}
@@ -6,6 +6,12 @@ NC="\033[0m"
 gcc ./test/test_get.c  -o get
 gcc ./test/test_ctl.c  -o ctl -pthread
 gcc ./test/test_send_recv.c  -o send_recv -pthread
+gcc ./test/test_send_multi.c  -o send_multi -pthread
+gcc ./test/test_waitset.c  -o waitset -pthread
+gcc ./test/test_fd.c  -o fd
+gcc ./test/test_history.c  -o history -pthread
+gcc ./test/test_subscribe.c  -o subscribe
+gcc ./test/test_dev.c  -o dev -pthread
 
 clear
 
@@ -13,9 +19,27 @@ echo -e "\n\n${YELLOW}*** testing tag_get ***${NC}\n"
 ./get
 echo -e "\n\n${YELLOW}*** testing tag_ctl ***${NC}\n"
 ./ctl
-echo -e "\n\n${YELLOW}*** testing tag_send and tag_receive ***${NC}\n"
+echo -e "\n\n${YELLOW}*** testing tag_send, tag_receive and tag_receive_mask ***${NC}\n"
 ./send_recv
+echo -e "\n\n${YELLOW}*** testing tag_send_multi ***${NC}\n"
+./send_multi
+echo -e "\n\n${YELLOW}*** testing tag_waitset and tag_waitset_wait ***${NC}\n"
+./waitset
+echo -e "\n\n${YELLOW}*** testing tag_fd ***${NC}\n"
+./fd
+echo -e "\n\n${YELLOW}*** testing tag_level_ctl and tag_receive_seq ***${NC}\n"
+./history
+echo -e "\n\n${YELLOW}*** testing tag_subscribe ***${NC}\n"
+./subscribe
+echo -e "\n\n${YELLOW}*** testing tag_dev ***${NC}\n"
+./dev
 
 rm get
 rm ctl
-rm send_recv
\ No newline at end of file
+rm send_recv
+rm send_multi
+rm waitset
+rm fd
+rm history
+rm subscribe
+rm dev
\ No newline at end of file
@@ -12,6 +12,15 @@
 #define TAG_SEND 174
 #define TAG_RECEIVE 182
 #define TAG_CTL 183
+#define TAG_SEND_MULTI 214
+#define TAG_SEND_MASK 215
+#define TAG_RECEIVE_MASK 236
+#define TAG_WAITSET 177
+#define TAG_WAITSET_WAIT 178
+#define TAG_FD 180
+#define TAG_LEVEL_CTL 181
+#define TAG_RECEIVE_SEQ 184
+#define TAG_SUBSCRIBE 185
 
 // Command numbers
 #define CREATE 1
@@ -19,13 +28,45 @@
 #define AWAKE_ALL 3
 #define REMOVE 4
 
+// Wait set command numbers
+#define WS_CREATE 1
+#define WS_ADD 2
+#define WS_REMOVE 3
+
+// Level command numbers
+#define LV_HISTORY 1
+#define LV_RETAIN 2
+
+// Subscription overflow policies
+#define SUB_DROP_OLDEST 0
+#define SUB_DROP_NEWEST 1
+#define SUB_SHARED 2
+
 #define BUFF_SIZE 1024
 
 
+struct tag_event_t{
+
+    int tag;        // tag service descriptor
+    int level;      // level number
+
+};
+
+
+struct tag_dest_t{
+
+    int tag;        // tag service descriptor
+    int level;      // level number
+    int ret;        // result of the send
+
+};
+
+
 struct info_t{
 
     int tag;        // tag service descriptor
     int lv;         // level number
+    unsigned long mask; // levels to receive from
 
     char *message;  // message to be sent or received
     int size;       // message size
@@ -58,3 +99,28 @@ void *receiver(void *arg){
 
     pthread_exit(NULL);
 }
+
+/*
+ * Receiver thread waiting on many levels, the level the message was delivered on is stored in lv
+ *
+ * arg = thread's arguments, must be a struct info_t
+ *
+ */
+void *mask_receiver(void *arg){
+    char *buffer;
+    struct info_t *i = (struct info_t *)arg;
+
+    buffer = (char *)malloc(sizeof(char)*BUFF_SIZE);
+
+    // Check if buffer was allocated
+    if(buffer == NULL){
+        i->ret = -1;
+        perror("Buffer allocation error");
+        pthread_exit(NULL);
+    }
+
+    i->ret = syscall(TAG_RECEIVE_MASK, i->tag, i->mask, buffer, BUFF_SIZE, &i->lv);
+    i->message = buffer;
+
+    pthread_exit(NULL);
+}
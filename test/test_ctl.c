@@ -9,6 +9,7 @@
 
 int main(void){
     int i, num, created, desc, uid, threads;
+    int descs[MAX_TAGS];
     pthread_t tids[RECVS];
     struct info_t *info[RECVS];
 
@@ -18,7 +19,7 @@ int main(void){
 
     // Creating tags
     for(i=0; i<MAX_TAGS; i++){
-        if(syscall(TAG_GET, i, CREATE, uid) >= 0){
+        if((descs[i] = syscall(TAG_GET, i, CREATE, uid)) >= 0){
             created ++;
         }
     }
@@ -31,7 +32,7 @@ int main(void){
     num = 0;
 
     for(i=0; i<MAX_TAGS; i++){
-        if(syscall(TAG_CTL, i, REMOVE) >= 0){
+        if(descs[i] >= 0 && syscall(TAG_CTL, descs[i], REMOVE) >= 0){
             num ++;
         }
     }
@@ -78,7 +79,7 @@ int main(void){
     printf("\t%d/%d tags awakened\n", num, threads);
 
     // Remove tag
-    syscall(TAG_CTL, 0, REMOVE);
+    syscall(TAG_CTL, desc, REMOVE);
 
     // Reclaim space
     for(i=0; i<RECVS; i++){
@@ -0,0 +1,179 @@
+/* ---------------------------------------------------------------------------------------------------------------------
+ TEST TAG DEVICE
+---------------------------------------------------------------------------------------------------------------------- */
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <poll.h>
+#include "./test.h"
+#include "../include/tag_dev.h"
+#include "../config.h"
+
+#define RECVS 4
+#define RECORDS 64
+#define MESSAGE "Sender message"
+#define DEVICE "/dev/tag_dev"
+
+/* Sums up the buckets of a histogram */
+unsigned long long samples(unsigned long long *hist){
+    unsigned long long total;
+    int i;
+
+    total = 0;
+    for(i=0; i<HIST_BUCKETS; i++) total += hist[i];
+
+    return total;
+}
+
+/* Counts the rows of the device file from its beginning */
+int rows(int fd){
+    char buffer[BUFF_SIZE];
+    int i, n, count;
+
+    if(lseek(fd, 0, SEEK_SET) < 0) return -1;
+
+    count = 0;
+    while((n = read(fd, buffer, BUFF_SIZE)) > 0){
+        for(i=0; i<n; i++) if(buffer[i] == '\n') count++;
+    }
+
+    return n < 0 ? -1 : count;
+}
+
+int main(void){
+    int i, desc, other, uid, threads, dev, before, after, idle, changed;
+    pthread_t tids[RECVS];
+    struct info_t *info[RECVS];
+    struct tag_hist_req hist;
+    struct tag_snapshot_req req;
+    struct tag_query_req query;
+    struct pollfd pfd;
+    struct tag_record records[RECORDS];
+    char *message;
+
+    uid = (int)getuid();
+
+    if((dev = open(DEVICE, O_RDONLY)) < 0){
+        perror("Unable to open device");
+        return -1;
+    }
+
+    // Create tag service
+    if((desc = syscall(TAG_GET, 0, CREATE, uid)) < 0){
+        perror("Tag service creation failed");
+        return -1;
+    }
+
+    // Spawn receivers
+    for(i=0; i<RECVS; i++){
+        info[i] = (struct info_t *)malloc(sizeof(struct info_t));
+        info[i]->tag = desc;
+        info[i]->lv = 1;
+        info[i]->message = NULL;
+        info[i]->ret = -1;
+    }
+
+    threads = 0;
+
+    for (i=0; i<RECVS; i++){
+        if(pthread_create(&tids[i], NULL, receiver, (void *)info[i]) == 0) threads++;
+    }
+
+    message = (char *)malloc(sizeof(char)*BUFF_SIZE);
+    snprintf(message, sizeof(char)*BUFF_SIZE, "%s\n", MESSAGE);
+
+    sleep(RECVS/2);
+
+    syscall(TAG_SEND, desc, 1, message, strlen(message) + 1);
+
+    for(i=0; i<RECVS; i++){
+        pthread_join(tids[i], NULL);
+    }
+
+// Latency histograms test ---------------------------------------------------------------------------------------------
+
+    printf("\nTesting reading latency histograms                      ...");
+
+    hist.tag = desc;
+
+    if(ioctl(dev, TAG_IOC_HIST, &hist) == 0){
+        printf("\t%llu/%d deliveries and %llu/%d waits recorded\n", samples(hist.delivery), threads, samples(hist.blocked), threads);
+    }
+    else{
+        printf("\tunable to read histograms\n");
+    }
+
+    printf("\nTesting resetting latency histograms                    ...");
+
+    if(ioctl(dev, TAG_IOC_HIST_RESET, &desc) == 0 && ioctl(dev, TAG_IOC_HIST, &hist) == 0){
+        printf("\t%llu samples left\n", samples(hist.delivery) + samples(hist.blocked));
+    }
+    else{
+        printf("\tunable to reset histograms\n");
+    }
+
+// Binary snapshot test ------------------------------------------------------------------------------------------------
+
+    printf("\nTesting reading a binary snapshot                       ...");
+
+    req.max = RECORDS;
+    req.records = records;
+
+    if(ioctl(dev, TAG_IOC_SNAPSHOT, &req) == 0 && req.version == TAG_SNAPSHOT_VERSION && req.size == sizeof(struct tag_record)){
+        for(i=0; i<(int)req.count && i<RECORDS; i++){
+            if(records[i].level == 1 && records[i].creator == uid) break;
+        }
+
+        if(i<(int)req.count && i<RECORDS) printf("\t%u records, level 1 delivered %llu messages\n", req.count, records[i].count[1]);
+        else printf("\t%u records, level 1 not found\n", req.count);
+    }
+    else{
+        printf("\tunable to read snapshot\n");
+    }
+
+// Single tag service query test ---------------------------------------------------------------------------------------
+
+    printf("\nTesting querying a single tag service                   ...");
+
+    query.tag = desc;
+
+    if(ioctl(dev, TAG_IOC_QUERY, &query) == 0 && query.count == 2 && query.records[0].level == -1){
+        printf("\t%u records, %llu messages delivered\n", query.count, query.records[0].count[1]);
+    }
+    else{
+        printf("\tunable to query tag service\n");
+    }
+
+// Device change notification test -------------------------------------------------------------------------------------
+
+    printf("\nTesting device poll after creating a tag service        ...");
+
+    pfd.fd = open(DEVICE, O_RDONLY);
+    pfd.events = POLLIN;
+
+    before = rows(pfd.fd);
+    idle = poll(&pfd, 1, 0);
+
+    other = syscall(TAG_GET, 0, CREATE, uid);
+    changed = poll(&pfd, 1, 1000);
+
+    after = rows(pfd.fd);
+
+    printf("\t%s before, %s after, %d rows then %d rows\n", idle == 0 ? "idle" : "ready", changed == 1 ? "ready" : "idle", before, after);
+
+    close(pfd.fd);
+
+    // Remove tags
+    syscall(TAG_CTL, other, REMOVE);
+    syscall(TAG_CTL, desc, REMOVE);
+
+    close(dev);
+
+    // Reclaim space
+    free(message);
+
+    for(i=0; i<RECVS; i++){
+        free(info[i]->message);
+        free(info[i]);
+    }
+}
@@ -0,0 +1,119 @@
+/* ---------------------------------------------------------------------------------------------------------------------
+ TEST TAG FD
+---------------------------------------------------------------------------------------------------------------------- */
+
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "./test.h"
+#include "../config.h"
+
+#define FDS 4
+#define MESSAGE "Sender message"
+
+int main(void){
+    int i, num, desc, uid, ret;
+    int fds[FDS];
+    struct pollfd pfds[FDS];
+    char *message, *buffer;
+
+    uid = (int)getuid();
+
+    // Create tag service
+    if((desc = syscall(TAG_GET, 0, CREATE, uid)) < 0){
+        perror("Tag service creation failed");
+        return -1;
+    }
+
+// Tag fd creation test ------------------------------------------------------------------------------------------------
+
+    printf("\nTesting file descriptor creation                        ...");
+
+    num = 0;
+
+    for(i=0; i<FDS; i++){
+        fds[i] = syscall(TAG_FD, desc, 1 + i % 2, O_NONBLOCK);
+        if(fds[i] >= 0) num++;
+    }
+
+    printf("\t%d/%d file descriptors created\n", num, FDS);
+
+    message = (char *)malloc(sizeof(char)*BUFF_SIZE);
+    buffer = (char *)malloc(sizeof(char)*BUFF_SIZE);
+    snprintf(message, sizeof(char)*BUFF_SIZE, "%s\n", MESSAGE);
+
+    printf("\nTesting reading without messages                        ...");
+
+    num = 0;
+
+    for(i=0; i<FDS; i++){
+        if(read(fds[i], buffer, BUFF_SIZE) < 0 && errno == EAGAIN) num++;
+    }
+
+    printf("\t%d/%d file descriptors would block\n", num, FDS);
+
+// Tag fd poll test ----------------------------------------------------------------------------------------------------
+
+    printf("\nTesting polling file descriptors                        ...");
+
+    // Only file descriptors on level 1 receive the message
+    syscall(TAG_SEND, desc, 1, message, strlen(message) + 1);
+
+    for(i=0; i<FDS; i++){
+        pfds[i].fd = fds[i];
+        pfds[i].events = POLLIN;
+    }
+
+    poll(pfds, FDS, 1000);
+
+    num = 0;
+
+    for(i=0; i<FDS; i++){
+        // Ready if and only if bound to level 1
+        if(((pfds[i].revents & POLLIN) != 0) == (i % 2 == 0)) num++;
+    }
+
+    printf("\t%d/%d file descriptors in the expected state\n", num, FDS);
+
+    printf("\nTesting reading messages                                ...");
+
+    num = 0;
+
+    for(i=0; i<FDS; i++){
+        memset(buffer, 0, sizeof(char)*BUFF_SIZE);
+        if(read(fds[i], buffer, BUFF_SIZE) > 0 && strcmp(buffer, message) == 0) num++;
+    }
+
+    printf("\t%d/%d file descriptors received the message\n", num, FDS/2);
+
+    printf("\nTesting reading after awaking all threads               ...");
+
+    syscall(TAG_CTL, desc, AWAKE_ALL);
+
+    num = 0;
+
+    for(i=0; i<FDS; i++){
+        if(read(fds[i], buffer, BUFF_SIZE) < 0 && errno == ECANCELED) num++;
+    }
+
+    printf("\t%d/%d file descriptors saw the wakeup\n", num, FDS);
+
+// Tag removal test ----------------------------------------------------------------------------------------------------
+
+    printf("\nTesting removing tag with open file descriptors         ...");
+
+    ret = syscall(TAG_CTL, desc, REMOVE);
+
+    printf("\t%s\n", ret < 0 ? "removal refused" : "tag removed");
+
+    // Close file descriptors
+    for(i=0; i<FDS; i++){
+        close(fds[i]);
+    }
+
+    // Remove tag
+    syscall(TAG_CTL, desc, REMOVE);
+
+    free(message);
+    free(buffer);
+}
@@ -8,6 +8,7 @@
 
 int main(void){
     int i, num, num_all, uid;
+    int descs[MAX_TAGS];
 
     uid = (int)getuid();
 
@@ -20,14 +21,14 @@ int main(void){
 
     // Creating half with user uid
     for(i=0; i<MAX_TAGS/2; i++){
-        if(syscall(TAG_GET, i, CREATE, uid) >= 0){
+        if((descs[i] = syscall(TAG_GET, i, CREATE, uid)) >= 0){
             num ++;
         }
     }
 
     // Creating half open to all users
     for(i=MAX_TAGS/2; i<MAX_TAGS; i++){
-        if(syscall(TAG_GET, i, CREATE, -1) >= 0){
+        if((descs[i] = syscall(TAG_GET, i, CREATE, -1)) >= 0){
             num_all ++;
         }
     }
@@ -88,6 +89,6 @@ int main(void){
 
     // Removing all tags
     for(i=0; i<MAX_TAGS; i++){
-        syscall(TAG_CTL, i, REMOVE);
+        if(descs[i] >= 0) syscall(TAG_CTL, descs[i], REMOVE);
     }
 }
\ No newline at end of file
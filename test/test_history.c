@@ -0,0 +1,165 @@
+/* ---------------------------------------------------------------------------------------------------------------------
+ TEST TAG HISTORY
+---------------------------------------------------------------------------------------------------------------------- */
+
+#include <fcntl.h>
+#include <errno.h>
+#include "./test.h"
+#include "../config.h"
+
+#define HISTORY 4
+#define MESSAGES 6
+#define MESSAGE "Sender message"
+
+struct seq_info_t{
+
+    int tag;                // tag service descriptor
+    int lv;                 // level number
+    unsigned long seq;      // sequence number already seen, then the one of the message received
+    char buffer[BUFF_SIZE]; // message received
+    int ret;                // return value
+    int err;                // errno if the receive failed
+
+};
+
+/*
+ * Receiver thread blocking until a message newer than seq is kept
+ *
+ * arg = thread's arguments, must be a struct seq_info_t
+ *
+ */
+void *seq_receiver(void *arg){
+    struct seq_info_t *i = (struct seq_info_t *)arg;
+
+    i->ret = syscall(TAG_RECEIVE_SEQ, i->tag, i->lv, i->buffer, BUFF_SIZE, &i->seq, 0);
+    i->err = errno;
+
+    pthread_exit(NULL);
+}
+
+int main(void){
+    int i, num, desc, uid, ret;
+    unsigned long seq, first;
+    struct seq_info_t info;
+    pthread_t tid;
+    char message[BUFF_SIZE], buffer[BUFF_SIZE];
+
+    uid = (int)getuid();
+
+    // Create tag service
+    if((desc = syscall(TAG_GET, 0, CREATE, uid)) < 0){
+        perror("Tag service creation failed");
+        return -1;
+    }
+
+// History test --------------------------------------------------------------------------------------------------------
+
+    printf("\nTesting enabling history                                ...");
+
+    ret = syscall(TAG_LEVEL_CTL, desc, 1, LV_HISTORY, HISTORY);
+
+    printf("\t%s\n", ret < 0 ? "unable to enable history" : "history enabled");
+
+    // Nobody is waiting, messages are only kept in the history
+    for(i=0; i<MESSAGES; i++){
+        snprintf(message, sizeof(message), "%s %d", MESSAGE, i);
+        syscall(TAG_SEND, desc, 1, message, strlen(message));
+    }
+
+    printf("\nTesting reading history without blocking                ...");
+
+    seq = 0;
+    first = 0;
+    num = 0;
+
+    while((ret = syscall(TAG_RECEIVE_SEQ, desc, 1, buffer, BUFF_SIZE, &seq, O_NONBLOCK)) >= 0){
+        if(first == 0) first = seq;
+        num++;
+    }
+
+    printf("\t%d/%d messages read, from %lu to %lu, then %s\n", num, HISTORY, first, seq, errno == EAGAIN ? "EAGAIN" : "error");
+
+    printf("\nTesting reading history of a level without it           ...");
+
+    seq = 0;
+    ret = syscall(TAG_RECEIVE_SEQ, desc, 2, buffer, BUFF_SIZE, &seq, O_NONBLOCK);
+
+    printf("\t%s\n", ret < 0 && errno == EINVAL ? "read refused" : "message read");
+
+// Blocking read test --------------------------------------------------------------------------------------------------
+
+    printf("\nTesting waiting for a newer message                     ...");
+
+    info.tag = desc;
+    info.lv = 1;
+    info.seq = seq;
+    info.ret = -1;
+
+    if(pthread_create(&tid, NULL, seq_receiver, (void *)&info) != 0){
+        printf("\tunable to create receiver\n");
+    }
+    else{
+        sleep(1);
+
+        snprintf(message, sizeof(message), "%s", MESSAGE);
+        syscall(TAG_SEND, desc, 1, message, strlen(message));
+
+        pthread_join(tid, NULL);
+
+        printf("\t%s with sequence number %lu\n", info.ret == strlen(MESSAGE) && strncmp(info.buffer, MESSAGE, info.ret) == 0 ? "message received" : "message not received", info.seq);
+    }
+
+    printf("\nTesting awaking a thread waiting for a newer message    ...");
+
+    info.ret = -1;
+
+    if(pthread_create(&tid, NULL, seq_receiver, (void *)&info) != 0){
+        printf("\tunable to create receiver\n");
+    }
+    else{
+        sleep(1);
+
+        syscall(TAG_CTL, desc, AWAKE_ALL);
+
+        pthread_join(tid, NULL);
+
+        printf("\t%s\n", info.ret < 0 && info.err == ECANCELED ? "ECANCELED" : "not awoken");
+    }
+
+// Retained message test -----------------------------------------------------------------------------------------------
+
+    printf("\nTesting reading the message retained by a late receiver ...");
+
+    syscall(TAG_LEVEL_CTL, desc, 3, LV_RETAIN, 1);
+
+    for(i=0; i<MESSAGES; i++){
+        snprintf(message, sizeof(message), "%s %d", MESSAGE, i);
+        syscall(TAG_SEND, desc, 3, message, strlen(message));
+    }
+
+    seq = 0;
+    ret = syscall(TAG_RECEIVE_SEQ, desc, 3, buffer, BUFF_SIZE, &seq, O_NONBLOCK);
+
+    printf("\t%s with sequence number %lu\n", ret == (int)strlen(message) && strncmp(buffer, message, ret) == 0 ? "last message read" : "last message not read", seq);
+
+    printf("\nTesting reading the message retained twice              ...");
+
+    ret = syscall(TAG_RECEIVE_SEQ, desc, 3, buffer, BUFF_SIZE, &seq, O_NONBLOCK);
+
+    printf("\t%s\n", ret < 0 && errno == EAGAIN ? "EAGAIN" : "message read again");
+
+    syscall(TAG_LEVEL_CTL, desc, 3, LV_RETAIN, 0);
+
+    printf("\nTesting disabling history                               ...");
+
+    syscall(TAG_LEVEL_CTL, desc, 1, LV_HISTORY, 0);
+    syscall(TAG_SEND, desc, 1, message, strlen(message));
+
+    seq = 0;
+    ret = syscall(TAG_RECEIVE_SEQ, desc, 1, buffer, BUFF_SIZE, &seq, O_NONBLOCK);
+
+    printf("\t%s\n", ret < 0 ? "message discarded" : "message kept");
+
+    // Remove tag
+    syscall(TAG_CTL, desc, REMOVE);
+}
@@ -0,0 +1,128 @@
+/* ---------------------------------------------------------------------------------------------------------------------
+ TEST TAG SEND MULTI AND TAG SEND MASK
+---------------------------------------------------------------------------------------------------------------------- */
+
+#include "./test.h"
+#include "../config.h"
+
+#define TAGS 2
+#define RECVS 4
+#define MESSAGE "Sender message"
+
+int main(void){
+    int i, num, uid, threads, ret;
+    int descs[TAGS];
+    pthread_t tids[RECVS];
+    struct info_t *info[RECVS];
+    struct tag_dest_t dests[TAGS + 1];
+    unsigned long mask;
+    char *message;
+
+    uid = (int)getuid();
+
+    // Create tag services
+    for(i=0; i<TAGS; i++){
+        if((descs[i] = syscall(TAG_GET, 0, CREATE, uid)) < 0){
+            perror("Tag service creation failed");
+            return -1;
+        }
+    }
+
+    // Spawn receivers, half on each tag service on a different level
+    for(i=0; i<RECVS; i++){
+        info[i] = (struct info_t *)malloc(sizeof(struct info_t));
+        info[i]->tag = descs[i % TAGS];
+        info[i]->lv = 1 + i % TAGS;
+        info[i]->message = NULL;
+        info[i]->ret = -1;
+    }
+
+    threads = 0;
+
+    for (i=0; i<RECVS; i++){
+        if(pthread_create(&tids[i], NULL, receiver, (void *)info[i]) == 0) threads++;
+    }
+
+    // Create new message
+    message = (char *)malloc(sizeof(char)*BUFF_SIZE);
+    snprintf(message, sizeof(char)*BUFF_SIZE, "%s\n", MESSAGE);
+
+    // Destinations, the last one has an invalid level
+    for(i=0; i<TAGS; i++){
+        dests[i].tag = descs[i];
+        dests[i].level = 1 + i;
+        dests[i].ret = -1;
+    }
+
+    dests[TAGS].tag = descs[0];
+    dests[TAGS].level = MAX_LV;
+    dests[TAGS].ret = 0;
+
+// Tag send multi test -------------------------------------------------------------------------------------------------
+
+    printf("\nTesting sending message to many tags                    ...");
+
+    sleep(RECVS/2);
+
+    ret = syscall(TAG_SEND_MULTI, dests, TAGS + 1, message, strlen(message) + 1);
+
+    num = 0;
+
+    for(i=0; i<RECVS; i++){
+        pthread_join(tids[i], NULL);
+        if(info[i]->ret >= 0 && strcmp(info[i]->message, message) == 0) num++;
+    }
+
+    printf("\t%d/%d tags successfully received the message\n", num, threads);
+
+    printf("\nTesting results of each destination                     ...");
+
+    printf("\t%d/%d destinations reached, invalid one %s\n", ret, TAGS, dests[TAGS].ret < 0 ? "rejected" : "accepted");
+
+// Tag send mask test --------------------------------------------------------------------------------------------------
+
+    // Spawn receivers on different levels of the same tag service
+    mask = 0;
+    threads = 0;
+
+    for(i=0; i<RECVS; i++){
+        free(info[i]->message);
+        info[i]->tag = descs[0];
+        info[i]->lv = 1 + i;
+        info[i]->message = NULL;
+        info[i]->ret = -1;
+
+        mask |= 1UL << info[i]->lv;
+
+        if(pthread_create(&tids[i], NULL, receiver, (void *)info[i]) == 0) threads++;
+    }
+
+    printf("\nTesting sending message to many levels                  ...");
+
+    sleep(RECVS/2);
+
+    ret = syscall(TAG_SEND_MASK, descs[0], mask, message, strlen(message) + 1);
+
+    num = 0;
+
+    for(i=0; i<RECVS; i++){
+        pthread_join(tids[i], NULL);
+        if(info[i]->ret >= 0 && strcmp(info[i]->message, message) == 0) num++;
+    }
+
+    printf("\t%d/%d levels successfully received the message, %d reported\n", num, threads, ret);
+
+    // Remove message
+    free(message);
+
+    // Remove tags
+    for(i=0; i<TAGS; i++){
+        syscall(TAG_CTL, descs[i], REMOVE);
+    }
+
+    // Reclaim space
+    for(i=0; i<RECVS; i++){
+        free(info[i]->message);
+        free(info[i]);
+    }
+}
@@ -1,5 +1,5 @@
 /* ---------------------------------------------------------------------------------------------------------------------
- TEST TAG SEND
+ TEST TAG SEND AND TAG RECEIVE
 ---------------------------------------------------------------------------------------------------------------------- */
 
 #include "./test.h"
@@ -7,6 +7,7 @@
 
 #define RECVS 5
 #define MESSAGE "Sender message"
+#define BINARY_SIZE 200
 
 int main(void){
     int i, num, desc, uid, threads;
@@ -88,11 +89,74 @@ int main(void){
 
     printf("\t%d/%d tags successfully received the message\n", num, threads);
 
+    // Reset info
+    for(i=0; i<RECVS; i++){
+        free(info[i]->message);
+        info[i]->message = NULL;
+    }
+
+    threads = 0;
+
+    for (i=0; i<RECVS; i++){
+        if(pthread_create(&tids[i], NULL, receiver, (void *)info[i]) == 0) threads++;
+    }
+
+    printf("\nTesting sending binary message                          ...");
+
+    sleep(RECVS/2);
+
+    // Message with embedded terminators
+    for(i=0; i<BINARY_SIZE; i++){
+        message[i] = (char)(i % 4 == 0 ? 0 : i);
+    }
+
+    syscall(TAG_SEND, desc, 1, message, BINARY_SIZE);
+
+    num = 0;
+
+    for(i=0; i<RECVS; i++){
+        pthread_join(tids[i], NULL);
+        if(info[i]->ret == BINARY_SIZE && memcmp(info[i]->message, message, BINARY_SIZE) == 0) num++;
+    }
+
+    printf("\t%d/%d tags successfully received %d bytes\n", num, threads, BINARY_SIZE);
+
+    snprintf(message, sizeof(char)*BUFF_SIZE, "%s\n", MESSAGE);
+
+    // Reset info, receivers wait on levels 1, 2 and 3
+    for(i=0; i<RECVS; i++){
+        free(info[i]->message);
+        info[i]->message = NULL;
+        info[i]->mask = (1UL << 1) | (1UL << 2) | (1UL << 3);
+        info[i]->lv = -1;
+    }
+
+    threads = 0;
+
+    for (i=0; i<RECVS; i++){
+        if(pthread_create(&tids[i], NULL, mask_receiver, (void *)info[i]) == 0) threads++;
+    }
+
+    printf("\nTesting receiving message from many levels              ...");
+
+    sleep(RECVS/2);
+
+    syscall(TAG_SEND, desc, 2, message, BUFF_SIZE);
+
+    num = 0;
+
+    for(i=0; i<RECVS; i++){
+        pthread_join(tids[i], NULL);
+        if(info[i]->ret >= 0 && info[i]->lv == 2 && strcmp(info[i]->message, message) == 0) num++;
+    }
+
+    printf("\t%d/%d tags successfully received the message\n", num, threads);
+
     // Remove message
     free(message);
 
     // Remove tag
-    syscall(TAG_CTL, 0, REMOVE);
+    syscall(TAG_CTL, desc, REMOVE);
 
     // Reclaim space
     for(i=0; i<RECVS; i++){
@@ -0,0 +1,224 @@
+/* ---------------------------------------------------------------------------------------------------------------------
+ TEST TAG SUBSCRIBE
+---------------------------------------------------------------------------------------------------------------------- */
+
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include "./test.h"
+#include "../config.h"
+#include "../include/tag_ring.h"
+
+#define DEPTH 4
+#define MESSAGES 6
+#define MESSAGE "Sender message"
+
+struct read_info_t{
+
+    int fd;                 // subscription file descriptor
+    int ret;                // return value
+    int err;                // errno if the read failed
+
+};
+
+/*
+ * Reader thread blocking on an empty mailbox
+ *
+ * arg = thread's arguments, must be a struct read_info_t
+ *
+ */
+void *blocked_reader(void *arg){
+    struct read_info_t *i = (struct read_info_t *)arg;
+    char buffer[BUFF_SIZE];
+
+    i->ret = read(i->fd, buffer, BUFF_SIZE);
+    i->err = errno;
+
+    pthread_exit(NULL);
+}
+
+/* Drains a subscription, returns the number of messages read and stores the index of the first one in first */
+int drain(int fd, int *first){
+    char buffer[BUFF_SIZE];
+    int n, ret;
+
+    n = 0;
+    *first = -1;
+
+    while((ret = read(fd, buffer, BUFF_SIZE - 1)) >= 0){
+        buffer[ret] = '\0';
+        if(n == 0) sscanf(buffer, MESSAGE " %d", first);
+        n++;
+    }
+
+    return errno == EAGAIN ? n : -1;
+}
+
+/* Maps the ring of a shared subscription, reading its layout from the first page */
+struct tag_ring *map_ring(int fd, size_t *size){
+    struct tag_ring *ring;
+    long page;
+
+    page = sysconf(_SC_PAGESIZE);
+
+    ring = (struct tag_ring *)mmap(NULL, page, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(ring == MAP_FAILED) return NULL;
+
+    *size = ((ring->offset + (size_t)ring->slots*ring->slot_size + page - 1)/page)*page;
+    munmap(ring, page);
+
+    ring = (struct tag_ring *)mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    return ring == MAP_FAILED ? NULL : ring;
+}
+
+/* Consumes the ring without system calls, returns the number of messages read and stores the first one in first */
+int consume(struct tag_ring *ring, int *first){
+    struct tag_ring_slot *slot;
+    unsigned int head, tail;
+    char buffer[BUFF_SIZE];
+    int n;
+
+    n = 0;
+    *first = -1;
+
+    head = ring->head;
+    tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    for(; head != tail; head++){
+        slot = TAG_RING_SLOT(ring, head);
+        snprintf(buffer, sizeof(buffer), "%.*s", (int)slot->size, slot->data);
+        if(n == 0) sscanf(buffer, MESSAGE " %d", first);
+        n++;
+    }
+
+    __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+
+    return n;
+}
+
+int main(void){
+    int i, desc, uid, ret, oldest, newest, shared, first;
+    struct tag_ring *ring;
+    size_t size;
+    struct pollfd pfd;
+    struct read_info_t info;
+    pthread_t tid;
+    char message[BUFF_SIZE];
+
+    uid = (int)getuid();
+
+    // Create tag service
+    if((desc = syscall(TAG_GET, 0, CREATE, uid)) < 0){
+        perror("Tag service creation failed");
+        return -1;
+    }
+
+// Subscription test ---------------------------------------------------------------------------------------------------
+
+    printf("\nTesting subscribing with both overflow policies         ...");
+
+    oldest = syscall(TAG_SUBSCRIBE, desc, 1, DEPTH, SUB_DROP_OLDEST, O_NONBLOCK);
+    newest = syscall(TAG_SUBSCRIBE, desc, 1, DEPTH, SUB_DROP_NEWEST, O_NONBLOCK);
+
+    printf("\t%s\n", oldest < 0 || newest < 0 ? "unable to subscribe" : "subscribed");
+
+    // Nobody is receiving, messages pile up in the mailboxes
+    for(i=0; i<MESSAGES; i++){
+        snprintf(message, sizeof(message), "%s %d", MESSAGE, i);
+        syscall(TAG_SEND, desc, 1, message, strlen(message));
+    }
+
+    printf("\nTesting polling a full mailbox                          ...");
+
+    pfd.fd = oldest;
+    pfd.events = POLLIN;
+
+    ret = poll(&pfd, 1, 0);
+
+    printf("\t%s\n", ret == 1 && (pfd.revents & POLLIN) ? "readable" : "not readable");
+
+    printf("\nTesting draining the mailbox dropping the oldest        ...");
+
+    ret = drain(oldest, &first);
+
+    printf("\t%d/%d messages read, starting from message %d\n", ret, DEPTH, first);
+
+    printf("\nTesting draining the mailbox dropping the newest        ...");
+
+    ret = drain(newest, &first);
+
+    printf("\t%d/%d messages read, starting from message %d\n", ret, DEPTH, first);
+
+    printf("\nTesting awaking a read blocked on an empty mailbox      ...");
+
+    info.fd = oldest;
+    info.ret = 0;
+
+    fcntl(oldest, F_SETFL, 0); // Blocking reads
+
+    if(pthread_create(&tid, NULL, blocked_reader, (void *)&info) != 0){
+        printf("\tunable to create reader\n");
+    }
+    else{
+        sleep(1);
+
+        syscall(TAG_CTL, desc, AWAKE_ALL);
+
+        pthread_join(tid, NULL);
+
+        printf("\t%s\n", info.ret < 0 && info.err == ECANCELED ? "ECANCELED" : "not awoken");
+    }
+
+// Shared ring test ----------------------------------------------------------------------------------------------------
+
+    printf("\nTesting mapping the ring of a shared subscription       ...");
+
+    shared = syscall(TAG_SUBSCRIBE, desc, 1, DEPTH, SUB_SHARED, O_NONBLOCK);
+    ring = shared < 0 ? NULL : map_ring(shared, &size);
+
+    if(ring != NULL) printf("\t%u slots of %u bytes mapped\n", ring->slots, ring->slot_size);
+    else printf("\tunable to map ring\n");
+
+    if(ring != NULL){
+        for(i=0; i<MESSAGES; i++){
+            snprintf(message, sizeof(message), "%s %d", MESSAGE, i);
+            syscall(TAG_SEND, desc, 1, message, strlen(message));
+        }
+
+        printf("\nTesting consuming the ring from user space              ...");
+
+        ret = consume(ring, &first);
+
+        printf("\t%d/%d messages read, starting from message %d, %u dropped\n", ret, DEPTH, first, ring->dropped);
+
+        printf("\nTesting polling the ring after a send                   ...");
+
+        pfd.fd = shared;
+        pfd.events = POLLIN;
+
+        ret = poll(&pfd, 1, 0);
+
+        syscall(TAG_SEND, desc, 1, MESSAGE, strlen(MESSAGE));
+
+        printf("\t%s before, %s after\n", ret == 0 ? "idle" : "ready", poll(&pfd, 1, 0) == 1 ? "ready" : "idle");
+
+        munmap(ring, size);
+    }
+
+// Tag removal test ----------------------------------------------------------------------------------------------------
+
+    printf("\nTesting removing tag with subscriptions                 ...");
+
+    ret = syscall(TAG_CTL, desc, REMOVE);
+
+    printf("\t%s\n", ret < 0 ? "removal refused" : "tag removed");
+
+    close(oldest);
+    close(newest);
+    close(shared);
+
+    // Remove tag
+    syscall(TAG_CTL, desc, REMOVE);
+}
@@ -0,0 +1,143 @@
+/* ---------------------------------------------------------------------------------------------------------------------
+ TEST TAG WAITSET
+---------------------------------------------------------------------------------------------------------------------- */
+
+#include "./test.h"
+#include "../config.h"
+
+#define TAGS 3
+#define MESSAGE "Sender message"
+
+struct ws_info_t{
+
+    int ws;                     // wait set descriptor
+    struct tag_event_t event;   // tag service and level the message was delivered on
+    char *message;              // message received
+    int ret;                    // return value
+
+};
+
+/*
+ * Receiver thread waiting on a wait set
+ *
+ * arg = thread's arguments, must be a struct ws_info_t
+ *
+ */
+void *ws_receiver(void *arg){
+    char *buffer;
+    struct ws_info_t *i = (struct ws_info_t *)arg;
+
+    buffer = (char *)malloc(sizeof(char)*BUFF_SIZE);
+
+    // Check if buffer was allocated
+    if(buffer == NULL){
+        i->ret = -1;
+        perror("Buffer allocation error");
+        pthread_exit(NULL);
+    }
+
+    memset(buffer, 0, sizeof(char)*BUFF_SIZE);
+
+    i->ret = syscall(TAG_WAITSET_WAIT, i->ws, &i->event, buffer, BUFF_SIZE);
+    i->message = buffer;
+
+    pthread_exit(NULL);
+}
+
+int main(void){
+    int i, ws, num, uid, ret;
+    int descs[TAGS];
+    pthread_t tid;
+    struct ws_info_t info;
+    char *message;
+
+    uid = (int)getuid();
+
+    // Create tag services
+    for(i=0; i<TAGS; i++){
+        if((descs[i] = syscall(TAG_GET, 0, CREATE, uid)) < 0){
+            perror("Tag service creation failed");
+            return -1;
+        }
+    }
+
+// Wait set creation test ----------------------------------------------------------------------------------------------
+
+    printf("\nTesting wait set creation                               ...");
+
+    ws = syscall(TAG_WAITSET, 0, WS_CREATE, 0, 0);
+
+    printf("\t%s\n", ws >= 0 ? "wait set created" : "unable to create wait set");
+
+    if(ws < 0) return -1;
+
+    printf("\nTesting adding tags to wait set                         ...");
+
+    num = 0;
+
+    for(i=0; i<TAGS; i++){
+        if(syscall(TAG_WAITSET, ws, WS_ADD, descs[i], i + 1) == 0) num++;
+    }
+
+    // Duplicates and invalid levels are rejected
+    if(syscall(TAG_WAITSET, ws, WS_ADD, descs[0], 1) == 0) num++;
+    if(syscall(TAG_WAITSET, ws, WS_ADD, descs[0], MAX_LV) == 0) num++;
+
+    printf("\t%d/%d pairs of tag and level added\n", num, TAGS);
+
+// Wait set wait test --------------------------------------------------------------------------------------------------
+
+    message = (char *)malloc(sizeof(char)*BUFF_SIZE);
+    snprintf(message, sizeof(char)*BUFF_SIZE, "%s\n", MESSAGE);
+
+    info.ws = ws;
+    info.message = NULL;
+    info.ret = -1;
+
+    printf("\nTesting receiving message from wait set                 ...");
+
+    if(pthread_create(&tid, NULL, ws_receiver, (void *)&info) != 0){
+        perror("Unable to create receiver");
+        return -1;
+    }
+
+    sleep(1);
+
+    // Send to the last tag service of the wait set
+    syscall(TAG_SEND, descs[TAGS - 1], TAGS, message, strlen(message) + 1);
+
+    pthread_join(tid, NULL);
+
+    ret = info.ret >= 0 && info.event.tag == descs[TAGS - 1] && info.event.level == TAGS && strcmp(info.message, message) == 0;
+
+    printf("\t%s\n", ret ? "message received from the right tag" : "message not received");
+
+    free(info.message);
+
+// Wait set removal test -----------------------------------------------------------------------------------------------
+
+    printf("\nTesting removing tags from wait set                     ...");
+
+    num = 0;
+
+    for(i=0; i<TAGS; i++){
+        if(syscall(TAG_WAITSET, ws, WS_REMOVE, descs[i], i + 1) == 0) num++;
+    }
+
+    printf("\t%d/%d pairs of tag and level removed\n", num, TAGS);
+
+    printf("\nTesting wait set removal                                ...");
+
+    close(ws);
+    ret = syscall(TAG_WAITSET, ws, WS_ADD, descs[0], 1);
+
+    printf("\t%s\n", ret < 0 ? "wait set removed" : "wait set still usable");
+
+    // Remove message
+    free(message);
+
+    // Remove tags
+    for(i=0; i<TAGS; i++){
+        syscall(TAG_CTL, descs[i], REMOVE);
+    }
+}